@@ -0,0 +1,213 @@
+#ifndef __batch_ingest_h
+#define __batch_ingest_h
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "lmdbfulltext.h"
+
+// tokenizes documents on a pool of worker threads (each with its own MecabModel session)
+// and writes them from a single writer (the calling thread) through LmdbFullText::GroupCommit.
+// documents over the memory budget are left to the writer, which reads and indexes them chunk by chunk
+class BatchIngest
+{
+public:
+    struct Source
+    {
+        std::string name;
+        std::string path;
+    };
+
+    BatchIngest(LmdbFullText& lft, unsigned int threads = std::thread::hardware_concurrency(),
+                std::size_t commit_docs = 64,
+                std::chrono::milliseconds commit_time = std::chrono::milliseconds::max())
+        : _lft(lft)
+        , _threads(threads ? threads : 1)
+        , _commit_docs(commit_docs)
+        , _commit_time(commit_time)
+    {
+    }
+
+    // every regular file below dir, named by its path relative to dir
+    static std::vector<Source> sources_from_directory(const std::string& dir)
+    {
+        std::vector<Source> sources;
+        for (auto& entry : std::filesystem::recursive_directory_iterator{dir})
+        {
+            if (!entry.is_regular_file())
+                continue;
+            sources.push_back({std::filesystem::relative(entry.path(), dir).generic_string(), entry.path().string()});
+        }
+        std::sort(sources.begin(), sources.end(), [](const Source& a, const Source& b) { return a.name < b.name; });
+        return sources;
+    }
+
+    // one file path per line, the path doubles as document name
+    static std::vector<Source> sources_from_list(const std::string& list_file)
+    {
+        std::vector<Source> sources;
+        std::ifstream in{list_file};
+        if (!in)
+            throw std::runtime_error{"couldn't open file list " + list_file};
+        for (std::string line; std::getline(in, line);)
+        {
+            if (!line.empty())
+                sources.push_back({line, line});
+        }
+        return sources;
+    }
+
+    // returns the number of documents added
+    std::size_t run(const std::vector<Source>& sources)
+    {
+        _next_source = 0;
+        _workers_done = 0;
+        _error = nullptr;
+
+        std::vector<std::thread> workers;
+        for (unsigned int i = 0; i < _threads; ++i)
+        {
+            workers.emplace_back([this, &sources] { tokenize_worker(sources); });
+        }
+
+        std::size_t added = 0;
+        try
+        {
+            added = write_all();
+        }
+        catch (...)
+        {
+            abort_workers(std::current_exception());
+        }
+
+        for (auto& w : workers) w.join();
+
+        if (_error)
+            std::rethrow_exception(_error);
+        return added;
+    }
+
+private:
+    struct Document
+    {
+        const Source* source;
+        std::unique_ptr<Mmap> content;  // none if over the memory budget
+        LmdbFullText::Tokens tokens;
+    };
+
+    void tokenize_worker(const std::vector<Source>& sources)
+    {
+        try
+        {
+            for (std::size_t i; (i = _next_source++) < sources.size();)
+            {
+                if (!std::filesystem::is_regular_file(sources[i].path))
+                {
+                    std::cerr << "skipping " << sources[i].path << ": not a regular file" << std::endl;
+                    continue;
+                }
+                if (std::filesystem::is_empty(sources[i].path))
+                {
+                    std::cerr << "skipping " << sources[i].path << ": empty" << std::endl;
+                    continue;
+                }
+
+                // too big to tokenize at once, the writer reads and indexes it chunk by chunk
+                Document doc{&sources[i], nullptr, {}};
+                if (_lft.fits_memory_budget(std::filesystem::file_size(sources[i].path)))
+                {
+                    StageTimer read_timer{_lft.stage_stats(), IngestStats::Read};
+                    doc.content = std::make_unique<Mmap>(sources[i].path);
+                    read_timer.stop();
+                    doc.tokens =
+                        LmdbFullText::tokenize(doc.content->ptr(), doc.content->size(), _lft.stage_stats());
+                }
+
+                std::unique_lock<std::mutex> lock{_mutex};
+                _not_full.wait(lock, [this] { return _queue.size() < queue_capacity() || _error; });
+                if (_error)
+                    break;
+                _queue.push_back(std::move(doc));
+                _not_empty.notify_one();
+            }
+        }
+        catch (...)
+        {
+            abort_workers(std::current_exception());
+        }
+
+        std::lock_guard<std::mutex> lock{_mutex};
+        ++_workers_done;
+        _not_empty.notify_one();
+    }
+
+    std::size_t write_all()
+    {
+        std::size_t added = 0;
+        LmdbFullText::GroupCommit group{_lft, _commit_docs, _commit_time};
+
+        while (true)
+        {
+            Document doc;
+            {
+                std::unique_lock<std::mutex> lock{_mutex};
+                _not_empty.wait(lock, [this] { return !_queue.empty() || _workers_done == _threads || _error; });
+                if (_error || _queue.empty())
+                    break;
+                doc = std::move(_queue.front());
+                _queue.pop_front();
+                _not_full.notify_one();
+            }
+
+            bool doc_added = doc.content ? group.add_document(doc.source->name, doc.content->ptr(),
+                                                              doc.content->size(), doc.tokens)
+                                         : group.add_document(doc.source->name, doc.source->path);
+            if (doc_added)
+                ++added;
+        }
+
+        // on error the pending group is aborted by GroupCommit's destructor
+        if (!_error)
+            group.commit();
+        return added;
+    }
+
+    void abort_workers(std::exception_ptr e)
+    {
+        std::lock_guard<std::mutex> lock{_mutex};
+        if (!_error)
+            _error = e;
+        _not_full.notify_all();
+        _not_empty.notify_all();
+    }
+
+    std::size_t queue_capacity() const
+    {
+        return 2 * _threads;
+    }
+
+    LmdbFullText& _lft;
+    const unsigned int _threads;
+    const std::size_t _commit_docs;
+    const std::chrono::milliseconds _commit_time;
+
+    std::atomic<std::size_t> _next_source{0};
+    std::mutex _mutex;
+    std::condition_variable _not_full;
+    std::condition_variable _not_empty;
+    std::deque<Document> _queue;
+    unsigned int _workers_done = 0;
+    std::exception_ptr _error;
+};
+
+#endif
@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include "lmdbfulltext.h"
+
+// uniform in [0, 1) from the raw output, which the standard pins down unlike the distributions
+static double uniform(std::mt19937_64& rng)
+{
+    return (rng() >> 11) * 0x1.0p-53;
+}
+
+// ranks 0..n-1, rank r drawn with probability proportional to 1 / (r + 1)^s
+class Zipf
+{
+public:
+    Zipf(std::size_t n, double s)
+    {
+        double sum = 0;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            sum += 1.0 / std::pow(i + 1, s);
+            _cdf.push_back(sum);
+        }
+        for (auto& c : _cdf) c /= sum;
+    }
+
+    std::size_t operator()(std::mt19937_64& rng) const
+    {
+        auto it = std::lower_bound(_cdf.begin(), _cdf.end(), uniform(rng));
+        return std::min<std::size_t>(it - _cdf.begin(), _cdf.size() - 1);
+    }
+
+private:
+    std::vector<double> _cdf;
+};
+
+// deterministic synthetic japanese-ish corpus: nouns, verbs, adjectives and katakana words drawn from a fixed
+// vocabulary with zipf distributed frequencies, joined by particles into sentences and lines.
+// only uses mt19937_64's raw output, which the standard pins down, so a seed gives the same corpus everywhere
+class SyntheticCorpus
+{
+public:
+    struct Config
+    {
+        std::size_t documents = 1000;
+        std::size_t words = 500;  // per document
+        std::size_t vocabulary = 20000;
+        double zipf = 1.0;  // exponent, 0 is uniform
+        uint64_t seed = 42;
+    };
+
+    SyntheticCorpus(const Config& config)
+        : _config(config)
+        , _rng(config.seed)
+        , _zipf(config.vocabulary, config.zipf)
+    {
+        for (std::size_t i = 0; i < config.vocabulary; ++i) _vocabulary.push_back(make_word(i));
+    }
+
+    const std::vector<std::string>& vocabulary() const
+    {
+        return _vocabulary;
+    }
+
+    // a vocabulary word, frequent ones more often
+    const std::string& word()
+    {
+        return _vocabulary[_zipf(_rng)];
+    }
+
+    std::string document()
+    {
+        static const char* particles[] = {"が", "を", "に", "は", "の", "で", "と", "も"};
+        std::string text;
+        for (std::size_t n = 0; n < _config.words;)
+        {
+            auto sentence = 4 + below(12);
+            for (std::size_t i = 0; i < sentence && n < _config.words; ++i, ++n)
+            {
+                text += word();
+                if (i + 1 < sentence)
+                    text += particles[below(std::size(particles))];
+            }
+            text += below(4) ? "。" : "。\n";
+        }
+        return text;
+    }
+
+private:
+    // word i of the vocabulary, a kanji compound, verb, adjective or katakana word
+    static std::string make_word(std::size_t i)
+    {
+        static const char* kanji[] = {"日", "本", "人", "年", "大", "中", "出", "学", "生", "国", "会", "事", "社",
+                                      "地", "時", "行", "見", "長", "場", "電", "話", "食", "書", "新", "聞", "手",
+                                      "気", "心", "水", "山", "川", "田", "空", "海", "花", "道", "車", "語", "文",
+                                      "今", "東", "西", "南", "北", "前", "後", "外", "間", "読", "物", "家", "店"};
+        static const char* kana[] = {"ア", "イ", "ウ", "エ", "オ", "カ", "キ", "ク", "ケ", "コ", "サ", "シ", "ス",
+                                     "セ", "ソ", "タ", "チ", "ツ", "テ", "ト", "ナ", "ニ", "ヌ", "ネ", "ノ", "マ",
+                                     "ミ", "ム", "メ", "モ", "ラ", "リ", "ル", "レ", "ロ", "ン", "ー"};
+        constexpr std::size_t k = std::size(kanji);
+        constexpr std::size_t n = std::size(kana);
+
+        auto rest = i / 4;
+        switch (i % 4)
+        {
+            case 0:
+            case 1:
+                return std::string{kanji[rest % k]} + kanji[rest / k % k] + (rest >= k * k ? kanji[rest / k / k % k] : "");
+            case 2:
+                return std::string{kanji[rest % k]} + (rest / k % 2 ? "べる" : "める") +
+                       (rest >= 2 * k ? kanji[rest / k / 2 % k] : "");
+            default:
+                return std::string{kana[rest % n]} + kana[rest / n % n] + kana[rest / n / n % n] + "ト";
+        }
+    }
+
+    std::size_t below(std::size_t n)
+    {
+        return _rng() % n;
+    }
+
+    Config _config;
+    std::mt19937_64 _rng;
+    Zipf _zipf;
+    std::vector<std::string> _vocabulary;
+};
+
+struct Latencies
+{
+    std::vector<double> us;
+
+    template <typename F>
+    void time(F&& f)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        f();
+        us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count());
+    }
+
+    // nearest rank
+    double percentile(double p)
+    {
+        if (us.empty())
+            return 0;
+        std::sort(us.begin(), us.end());
+        auto rank = (std::size_t)std::ceil(p / 100.0 * us.size());
+        return us[std::max<std::size_t>(rank, 1) - 1];
+    }
+
+    void json(std::ostream& out, std::size_t results)
+    {
+        out << "{\"queries\": " << us.size() << ", \"results\": " << results << ", \"p50_us\": " << percentile(50)
+            << ", \"p90_us\": " << percentile(90) << ", \"p99_us\": " << percentile(99)
+            << ", \"max_us\": " << percentile(100) << "}";
+    }
+};
+
+static uint64_t directory_size(const std::filesystem::path& dir)
+{
+    uint64_t size = 0;
+    for (auto& entry : std::filesystem::directory_iterator{dir})
+    {
+        if (entry.is_regular_file())
+            size += entry.file_size();
+    }
+    return size;
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> args{argv + 1, argv + argc};
+    SyntheticCorpus::Config config;
+    std::size_t queries = 1000;
+    std::string db;
+
+    for (auto arg = args.begin(); arg != args.end(); ++arg)
+    {
+        if (arg + 1 == args.end())
+        {
+            std::cerr << "usage: " << argv[0]
+                      << " [--documents N] [--words N] [--vocabulary N] [--zipf S] [--seed N] [--queries N] [--db DIR]"
+                      << std::endl;
+            return 1;
+        }
+        if (*arg == "--documents")
+            config.documents = std::stoul(*(++arg));
+        else if (*arg == "--words")
+            config.words = std::stoul(*(++arg));
+        else if (*arg == "--vocabulary")
+            config.vocabulary = std::max(1UL, std::stoul(*(++arg)));
+        else if (*arg == "--zipf")
+            config.zipf = std::stod(*(++arg));
+        else if (*arg == "--seed")
+            config.seed = std::stoull(*(++arg));
+        else if (*arg == "--queries")
+            queries = std::stoul(*(++arg));
+        else if (*arg == "--db")
+            db = *(++arg);
+        else
+        {
+            std::cerr << "unknown option " << *arg << std::endl;
+            return 1;
+        }
+    }
+
+    // a throwaway db unless asked to keep it
+    bool keep = !db.empty();
+    if (!keep)
+        db = (std::filesystem::temp_directory_path() / ("rei-bench-" + std::to_string(getpid()))).string();
+    std::filesystem::create_directories(db);
+    if (!std::filesystem::is_empty(db))
+    {
+        std::cerr << db << " isn't empty" << std::endl;
+        return 1;
+    }
+
+    SyntheticCorpus corpus{config};
+    std::vector<std::string> documents;
+    uint64_t bytes = 0;
+    for (std::size_t i = 0; i < config.documents; ++i)
+    {
+        documents.push_back(corpus.document());
+        bytes += documents.back().size();
+    }
+
+    std::cout << "{\n  \"config\": {\"documents\": " << config.documents << ", \"words\": " << config.words
+              << ", \"vocabulary\": " << config.vocabulary << ", \"zipf\": " << config.zipf
+              << ", \"seed\": " << config.seed << ", \"queries\": " << queries << "},\n";
+    std::cout << std::fixed << std::setprecision(1);
+
+    {
+        LmdbFullText lft{db};
+        auto begin = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < documents.size(); ++i)
+        {
+            lft.add_document("doc" + std::to_string(i), documents[i].data(), documents[i].size());
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        std::cout << "  \"add_document\": {\"documents\": " << documents.size() << ", \"bytes\": " << bytes
+                  << ", \"seconds\": " << std::setprecision(3) << seconds << std::setprecision(1)
+                  << ", \"docs_per_sec\": " << documents.size() / seconds
+                  << ", \"mb_per_sec\": " << bytes / seconds / (1024 * 1024) << "},\n";
+    }
+
+    {
+        // queries follow the index' own word distribution, as a query log would: the indexed base forms, most
+        // frequent first, drawn with the corpus' zipf exponent. MeCab splits some generated words differently, so
+        // drawing from the vocabulary would time misses
+        LmdbFullText lft{db, true};
+        std::vector<std::pair<uint64_t, std::string>> dictionary;
+        for (auto& w : lft.word_list()) dictionary.emplace_back(0, w.to_str());
+        for (auto& [occurrences, word] : dictionary) occurrences = lft.word_stats(word).occurrences;
+        std::sort(dictionary.begin(), dictionary.end(),
+                  [](auto& a, auto& b) { return a.first > b.first || (a.first == b.first && a.second < b.second); });
+
+        std::vector<std::string> terms;
+        if (!dictionary.empty())
+        {
+            Zipf ranks{dictionary.size(), config.zipf};
+            std::mt19937_64 rng{config.seed + 1};
+            for (std::size_t i = 0; i < queries; ++i) terms.push_back(dictionary[ranks(rng)].second);
+        }
+
+        Latencies indices;
+        std::size_t postings = 0;
+        for (auto& term : terms)
+        {
+            indices.time([&] {
+                auto term_indices = lft.word_indices(term);
+                for (auto block : term_indices.blocks()) postings += block.size();
+            });
+        }
+
+        Latencies counts;
+        std::size_t occurrences = 0;
+        for (auto& term : terms)
+        {
+            counts.time([&] { occurrences += lft.word_occurrence_count(term); });
+        }
+
+        std::cout << "  \"word_indices\": ";
+        indices.json(std::cout, postings);
+        std::cout << ",\n  \"word_occurrence_count\": ";
+        counts.json(std::cout, occurrences);
+        std::cout << ",\n";
+    }
+
+    std::cout << "  \"index\": {\"bytes\": " << directory_size(db) << "}\n}" << std::endl;
+
+    if (!keep)
+        std::filesystem::remove_all(db);
+    return 0;
+}
@@ -0,0 +1,107 @@
+#ifndef __ingest_stats_h
+#define __ingest_stats_h
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// where ingest time goes, summed over all documents. stages may run on several threads at once (see BatchIngest),
+// so their times add up to more than the wall clock time then. the counters are cheap and always kept, timing the
+// stages costs a couple of clock reads per stage and document, and tokenize() then holds a document's tagged nodes
+// until they are grouped. LmdbFullText adds both to totals in the meta dbi with every commit
+struct IngestStats
+{
+    enum Stage
+    {
+        Read,     // mapping the file in, Mmap populates it up front
+        Tag,      // MeCab
+        TermMap,  // grouping the tagged words by base form and reading
+        Write,    // document, postings and stats puts
+        Commit,
+        stage_count
+    };
+
+    static constexpr const char* stage_names[stage_count] = {"read", "tag", "term map", "write", "commit"};
+
+    std::atomic<uint64_t> nanoseconds[stage_count] = {};
+    std::atomic<uint64_t> documents{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> tokens{0};
+    std::atomic<uint64_t> terms{0};     // distinct words per document, summed
+    std::atomic<uint64_t> readings{0};  // likewise for readings
+    std::atomic<uint64_t> commits{0};
+    std::atomic<uint64_t> pages{0};  // the db file grew by, LMDB doesn't count the pages a commit rewrites in place
+
+    // the counters in declaration order, then the stage times. how the totals are stored
+    static constexpr std::size_t field_count = 7 + stage_count;
+    using Fields = std::array<uint64_t, field_count>;
+
+    void add(Stage stage, std::chrono::steady_clock::duration d)
+    {
+        nanoseconds[stage].fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count(),
+                                     std::memory_order_relaxed);
+    }
+
+    Fields fields() const
+    {
+        Fields f{documents, bytes, tokens, terms, readings, commits, pages};
+        for (int i = 0; i < stage_count; ++i) f[7 + i] = nanoseconds[i];
+        return f;
+    }
+
+    void add(const Fields& f)
+    {
+        std::atomic<uint64_t>* counters[] = {&documents, &bytes, &tokens, &terms, &readings, &commits, &pages};
+        for (int i = 0; i < 7; ++i) *counters[i] += f[i];
+        for (int i = 0; i < stage_count; ++i) nanoseconds[i] += f[7 + i];
+    }
+
+    void print(std::ostream& out) const
+    {
+        out << "documents " << documents << '\n'
+            << "bytes " << bytes << '\n'
+            << "tokens " << tokens << '\n'
+            << "terms " << terms << '\n'
+            << "readings " << readings << '\n'
+            << "commits " << commits << '\n'
+            << "new pages " << pages << '\n';
+        for (int i = 0; i < stage_count; ++i)
+        {
+            out << stage_names[i] << ' ' << nanoseconds[i] / 1000 << "us\n";
+        }
+    }
+};
+
+// adds the time until it goes out of scope to a stage, if there are stats
+class StageTimer
+{
+public:
+    StageTimer(IngestStats* stats, IngestStats::Stage stage)
+        : _stats(stats)
+        , _stage(stage)
+    {
+        if (_stats)
+            _begin = std::chrono::steady_clock::now();
+    }
+
+    ~StageTimer()
+    {
+        stop();
+    }
+
+    void stop()
+    {
+        if (_stats)
+            _stats->add(_stage, std::chrono::steady_clock::now() - _begin);
+        _stats = nullptr;
+    }
+
+private:
+    IngestStats* _stats;
+    IngestStats::Stage _stage;
+    std::chrono::steady_clock::time_point _begin;
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef __kwic_h
+#define __kwic_h
+
+#include <cstdint>
+#include <string_view>
+#include "mecab_tagger.h"
+
+// keyword in context: slices the text around a word occurrence without copying anything
+namespace kwic
+{
+
+// views into the document, valid as long as it is
+struct Context
+{
+    std::string_view left;
+    std::string_view word;
+    std::string_view right;
+};
+
+inline bool is_continuation(char ch)
+{
+    return ((unsigned char)ch & 0xc0) == 0x80;
+}
+
+// start of the character n characters before pos, not going past begin
+inline std::size_t back(std::string_view text, std::size_t pos, std::size_t begin, std::size_t n)
+{
+    for (; n > 0 && pos > begin; --n)
+    {
+        --pos;
+        while (pos > begin && is_continuation(text[pos])) --pos;
+    }
+    return pos;
+}
+
+// end of the character n characters after pos, not going past end
+inline std::size_t forward(std::string_view text, std::size_t pos, std::size_t end, std::size_t n)
+{
+    for (; n > 0 && pos < end; --n)
+    {
+        ++pos;
+        while (pos < end && is_continuation(text[pos])) ++pos;
+    }
+    return pos;
+}
+
+// characters tokenized on either side of a word to find its length. MeCab's segmentation of the word barely
+// depends on text this far away, and it keeps examples cheap on long lines
+inline constexpr std::size_t tokenize_window = 64;
+
+// up to width characters on either side of the word at location, within the word's line.
+// the word's surface form isn't stored in the postings, so the text around it is tokenized again to find its length
+inline Context slice(std::string_view text, uint32_t location, std::size_t width)
+{
+    if (location >= text.size())
+        return {};
+
+    auto line_begin = text.rfind('\n', location);
+    line_begin = line_begin == std::string_view::npos ? 0 : line_begin + 1;
+    auto line_end = text.find('\n', location);
+    line_end = line_end == std::string_view::npos ? text.size() : line_end;
+
+    std::size_t word_end = forward(text, location, line_end, 1);
+    auto window_begin = back(text, location, line_begin, tokenize_window);
+    auto window_end = forward(text, location, line_end, tokenize_window);
+    tagging::MecabTagger tagger{text.data() + window_begin, window_end - window_begin};
+    for (tagging::Node n; tagger.next(n) && window_begin + n.location <= location;)
+    {
+        if (window_begin + n.location == location)
+        {
+            word_end = location + n.word.size();
+            break;
+        }
+    }
+
+    auto left = back(text, location, line_begin, width);
+    auto right = forward(text, word_end, line_end, width);
+    return Context{text.substr(left, location - left), text.substr(location, word_end - location),
+                   text.substr(word_end, right - word_end)};
+}
+
+}  // namespace kwic
+
+#endif
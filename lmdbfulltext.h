@@ -1,17 +1,31 @@
 #ifndef __lmdbfulltext_h
 #define __lmdbfulltext_h
 
+#include <cerrno>
+#include <chrono>
 #include <cstdint>
 #include <cstring>
+#include <fcntl.h>
+#include <filesystem>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <sys/file.h>
+#include <system_error>
+#include <unistd.h>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include "lmdbpp.h"
+#include "ingest_stats.h"
+#include "kwic.h"
 #include "lmdbpp_containers.h"
 #include "mecab_tagger.h"
 #include "mmap.h"
+#include "posting_runs.h"
+#include "postings.h"
+#include "query.h"
+#include "ranking.h"
 
 using namespace lmdbpp;
 using tagging::MecabTagger;
@@ -19,133 +33,676 @@ using tagging::MecabTagger;
 class LmdbFullText
 {
 public:
-    union WordIdx {
-        uint64_t n;
-        uint32_t parts[2];  //{doc idx, word location}
-    };
+    using WordIdx = postings::WordIdx;
+
+    // per term totals, updated in the same transaction as the term's postings
+    using TermStats = postings::TermStats;
 
-    LmdbFullText(std::string& db_path)
+    // read_only opens the env with MDB_RDONLY and the dbis in a read transaction, so it never waits on the writer
+    // lock and can run next to an ingest. the db has to exist already.
+    // bulk is for building an index in one go: commits only write to the map and the os flushes it whenever, once
+    // finish_bulk_load() (or the destructor) syncs at the end. until then the meta dbi holds a marker, synced before
+    // anything else is written, and the loader holds an exclusive flock on bulk.lock in the db directory. a db with
+    // the marker but no loader holding the lock refuses to open, as a crash may have left it inconsistent.
+    // with MDB_WRITEMAP, LMDB grows the file to the map size up front, sparse on most file systems
+    LmdbFullText(const std::string& db_path, bool read_only = false, bool bulk = false)
+        : _read_only(read_only)
     {
-        _env.set_maxdbs(3);
+        _env.set_maxdbs(11);
         _env.set_mapsize(1UL * 1024UL * 1024UL * 1024UL * 1024UL);  // 1tib
-        _env.open(db_path);
+        // NOTLS so pooled read transactions can move between threads
+        _env.open(db_path, MDB_NOTLS | (read_only ? MDB_RDONLY : 0) |
+                               (bulk && !read_only ? MDB_WRITEMAP | MDB_NOSYNC | MDB_MAPASYNC : 0));
 
+        // dbi handles opened in a read transaction only stay open if it commits, at the end of this block
+        bool marked;
         {
-            Txn txn{_env, 0, true};
-            _dbi_document_content = txn.open_dbi("document_content", MDB_CREATE);
-            _dbi_document_info = txn.open_dbi("document_info", MDB_CREATE);
-            _dbi_word_idx = txn.open_dbi("word_idx", MDB_CREATE | MDB_DUPFIXED | MDB_DUPSORT);
+            unsigned int create = read_only ? 0 : MDB_CREATE;
+            Txn txn{_env, read_only ? MDB_RDONLY : 0u, true};
+            try
+            {
+                _dbi_meta = txn.open_dbi("meta", create);
+                _dbi_document_id = txn.open_dbi("document_id", create);
+                _dbi_document_content = txn.open_dbi("document_content", create | MDB_INTEGERKEY);
+                // content of streamed documents, in chunks of whole lines. see ChunkKey
+                _dbi_document_chunks = txn.open_dbi("document_chunks", create);
+                _dbi_document_info = txn.open_dbi("document_info", create | MDB_INTEGERKEY);
+                // number of indexed words per document, for ranking
+                _dbi_document_length = txn.open_dbi("document_length", create | MDB_INTEGERKEY);
+                // '\0' separated terms of each document, so its postings can be removed without a scan
+                _dbi_document_terms = txn.open_dbi("document_terms", create | MDB_INTEGERKEY);
+                // values are compressed posting blocks, see postings.h
+                _dbi_word_idx = txn.open_dbi("word_idx", create | MDB_DUPSORT);
+                _dbi_word_stats = txn.open_dbi("word_stats", create);
+                // kana reading -> postings of the words read that way, same format as word_idx
+                _dbi_reading_idx = txn.open_dbi("reading_idx", create | MDB_DUPSORT);
+                _dbi_document_readings = txn.open_dbi("document_readings", create | MDB_INTEGERKEY);
+            }
+            catch (NotFoundError& e)
+            {
+                throw std::runtime_error{db_path + " is missing tables, it has to be (re)built by a writer first"};
+            }
+
+            KeyVal<char, char> marker{{_bulk_load_key}, {}};
+            marked = txn.try_get(_dbi_meta, marker).found();
+        }
+        if (marked)
+            check_bulk_load(db_path);
+
+        if (bulk && !read_only)
+        {
+            // waits for a running bulk load, or a check_bulk_load() of another process
+            _bulk_lock = open(bulk_lock_path(db_path).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (_bulk_lock < 0)
+                throw std::system_error{errno, std::generic_category(), "couldn't open " + bulk_lock_path(db_path)};
+            while (flock(_bulk_lock, LOCK_EX) < 0)
+            {
+                if (errno != EINTR)
+                    throw std::system_error{errno, std::generic_category(), "couldn't lock " + bulk_lock_path(db_path)};
+            }
+
+            Txn txn{_env};
+            txn.put(_dbi_meta, Val<char>{_bulk_load_key}, Val<char>{std::string_view{"1"}});
+            txn.commit();
+            _env.sync();
+            _bulk = true;
         }
     }
 
+    // a bulk load that wasn't finished is finished now, unless that fails, which leaves the marker
     ~LmdbFullText()
     {
+        try
+        {
+            flush_ingest_stats();
+            finish_bulk_load();
+        }
+        catch (std::exception& e)
+        {
+        }
+        if (_bulk_lock >= 0)
+            close(_bulk_lock);
     }
 
-    bool add_document(const std::string& name, const void* ptr, std::size_t size)
+    // syncs everything a bulk load committed and only then removes its marker, and syncs that too.
+    // nothing to do if not opened for a bulk load
+    void finish_bulk_load()
+    {
+        if (!_bulk)
+            return;
+
+        flush_ingest_stats();
+        _env.sync();
+        Txn txn{_env};
+        txn.del(_dbi_meta, Val<char>{_bulk_load_key});
+        txn.commit();
+        _env.sync();
+        _bulk = false;
+        close(_bulk_lock);
+        _bulk_lock = -1;
+    }
+
+    struct Occurrence
+    {
+        uint32_t location;  // offset in bytes
+        uint32_t position;  // ordinal among the document's indexed words
+        tagging::Pos pos;
+    };
+
+    // word base form -> its occurrences inside one document.
+    // keys are views into the document or MeCab's dictionary, so the document has to outlive them
+    using TermLocations = std::unordered_map<std::string_view, std::vector<Occurrence>>;
+
+    // a document's words by base form and by reading, from the same tokenization pass
+    struct Tokens
+    {
+        TermLocations words;
+        TermLocations readings;
+    };
+
+    // tokenize a document without touching the db, safe to call from multiple threads.
+    // words are grouped as MeCab tags them. only when collecting stats are all of the document's nodes tagged
+    // first and grouped after, so the two stages can be timed apart
+    static Tokens tokenize(const void* ptr, std::size_t size, IngestStats* stats = nullptr)
     {
-        auto name_hash = strhash(name);
+        Tokens tokens{};
+        uint32_t position = 0;
+        auto add = [&](const tagging::Node& n) {
+            Occurrence occurrence{n.location, position++, n.pos()};
+            tokens.words[n.base()].push_back(occurrence);
+
+            auto reading = n.reading();
+            if (!reading.empty() && reading != "*")
+                tokens.readings[reading].push_back(occurrence);
+        };
 
-        // write document info and content
+        StageTimer tag_timer{stats, IngestStats::Tag};
+        MecabTagger tagger{(const char*)ptr, size};
+        if (!stats)
         {
-            KeyVal<decltype(name_hash), char> kv{{&name_hash, sizeof(name_hash)}, {name}};
+            for (tagging::Node n; tagger.next(n);) add(n);
+            return tokens;
+        }
 
-            Txn txn{_env, 0, true};
-            try
+        std::vector<tagging::Node> nodes;
+        for (tagging::Node n; tagger.next(n);) nodes.push_back(n);
+        tag_timer.stop();
+
+        StageTimer term_map_timer{stats, IngestStats::TermMap};
+        for (auto& n : nodes) add(n);
+        return tokens;
+    }
+
+    // whether a document's tokens can be collected in memory at once: an Occurrence per word (2 or 3 characters
+    // of 3 bytes in japanese) for its base form and another for its reading, plus the term maps
+    bool fits_memory_budget(std::size_t size) const
+    {
+        return size / 3 * 4 * sizeof(Occurrence) <= _memory_budget;
+    }
+
+    // groups document inserts into shared write transactions to amortize the commit/fsync cost.
+    // the transaction is committed after max_docs documents or once max_time has passed since it began.
+    // anything not yet committed is aborted on destruction, call commit() when done.
+    class GroupCommit
+    {
+    public:
+        GroupCommit(LmdbFullText& lft, std::size_t max_docs,
+                    std::chrono::milliseconds max_time = std::chrono::milliseconds::max())
+            : _lft(lft)
+            , _max_docs(max_docs ? max_docs : 1)
+            , _max_time(max_time)
+        {
+        }
+
+        ~GroupCommit()
+        {
+            if (_docs)
+                _txn.abort();
+        }
+
+        bool add_document(const std::string& name, const void* ptr, std::size_t size, const Tokens& tokens)
+        {
+            return add([&] { return _lft.put_document(_txn, name, ptr, size, tokens); });
+        }
+
+        // a document too big for the memory budget, read from its file and indexed chunk by chunk
+        bool add_document(const std::string& name, const std::string& file_path)
+        {
+            File file{file_path};
+            FdChunks chunks{file.fd, stream_chunk_size, _lft._stage_stats};
+            return add([&] { return _lft.put_document_chunks(_txn, name, chunks); });
+        }
+
+        void commit()
+        {
+            if (_docs)
             {
-                txn.put(_dbi_document_info, kv, MDB_NOOVERWRITE);
+                _docs = 0;
+                _lft.commit(_txn);
             }
-            catch (KeyExistsError& e)
+        }
+
+    private:
+        template <typename F>
+        bool add(F&& put)
+        {
+            if (_docs == 0)
             {
-                std::cout << "document " << name << " already exists" << std::endl;  // TODO
-                return false;
+                _txn = Txn{_lft._env};
+                _begin = std::chrono::steady_clock::now();
             }
+            ++_docs;
+
+            bool added = put();
 
-            txn.put(_dbi_document_content, kv.key, Val<void>{ptr, size});
+            auto elapsed = std::chrono::steady_clock::now() - _begin;
+            if (_docs >= _max_docs || std::chrono::duration_cast<std::chrono::milliseconds>(elapsed) >= _max_time)
+                commit();
+            return added;
         }
 
-        MecabTagger tagger{(const char*)ptr, size};
+        LmdbFullText& _lft;
+        const std::size_t _max_docs;
+        const std::chrono::milliseconds _max_time;
+        Txn _txn{};
+        std::size_t _docs = 0;
+        std::chrono::steady_clock::time_point _begin;
+    };
+
+    // info, content and postings are written in a single transaction.
+    // documents too big for the memory budget are indexed chunk by chunk like streamed ones
+    bool add_document(const std::string& name, const void* ptr, std::size_t size)
+    {
+        if (!fits_memory_budget(size))
+        {
+            MemoryChunks chunks{ptr, size, stream_chunk_size};
+            return add_document_chunks(name, chunks);
+        }
+
+        auto tokens = tokenize(ptr, size, _stage_stats);
+
+        Txn txn{_env};
+        try
+        {
+            if (!put_document(txn, name, ptr, size, tokens))
+            {
+                txn.abort();
+                return false;
+            }
+        }
+        catch (...)
+        {
+            txn.abort();
+            throw;
+        }
+        commit(txn);
+        return true;
+    }
 
-        std::unordered_map<std::string, std::vector<WordIdx>> word_locations{};
+    static constexpr std::size_t stream_chunk_size = 1 << 20;
+    static constexpr std::size_t default_memory_budget = 256 << 20;
 
-        MDB_txn* txn;
-        WordIdx idx;
-        for (tagging::Node n; tagger.next(n);)
+    // about how much memory a document's postings may take while it's indexed. beyond it they are spilled to
+    // temporary files, see postings::PostingRuns. LMDB's own dirty pages come on top
+    void set_memory_budget(std::size_t bytes)
+    {
+        _memory_budget = bytes;
+    }
+
+    // adds a document read from fd (stdin, a pipe, ...) until EOF. it's taken in chunks of whole lines of about
+    // chunk_size bytes, which are tokenized and stored one at a time, their postings are collected within the
+    // memory budget. so memory use depends on the chunk size, the longest line and the budget, not on the size
+    // of the document. still a single transaction, readers see all of the document or nothing
+    bool add_document_stream(const std::string& name, int fd, std::size_t chunk_size = stream_chunk_size)
+    {
+        FdChunks chunks{fd, chunk_size ? chunk_size : 1, _stage_stats};
+        return add_document_chunks(name, chunks);
+    }
+
+    // write a whole pre-tokenized document inside an existing write transaction
+    bool put_document(Txn& txn, const std::string& name, const void* ptr, std::size_t size, const Tokens& tokens)
+    {
+        StageTimer timer{_stage_stats, IngestStats::Write};
+        uint32_t doc_id;
+        if (!put_document_info(txn, doc_id, name))
+            return false;
+        txn.put(_dbi_document_content, Val<uint32_t>{&doc_id}, Val<void>{ptr, size});
+        put_document_length(txn, doc_id, word_count(tokens.words));
+        put_locations(txn, _dbi_word_idx, _dbi_document_terms, doc_id, tokens.words, true);
+        put_locations(txn, _dbi_reading_idx, _dbi_document_readings, doc_id, tokens.readings, false);
+
+        _stats.documents += 1;
+        _stats.bytes += size;
+        _stats.tokens += word_count(tokens.words);
+        _stats.terms += tokens.words.size();
+        _stats.readings += tokens.readings.size();
+        return true;
+    }
+
+    // removes a document and its postings, false if there is no such document
+    bool delete_document(const std::string& name)
+    {
+        Txn txn{_env};
+        try
         {
-            auto it = word_locations.find(n.base);
-            if (it == word_locations.end())
+            if (!remove_document(txn, name))
             {
-                std::tie(it, std::ignore) =
-                    word_locations.insert(std::pair<std::string, std::vector<WordIdx>>(n.base, std::vector<WordIdx>{}));
+                txn.abort();
+                return false;
             }
-            idx.parts[0] = name_hash;
-            idx.parts[1] = n.location;
-            it->second.push_back(idx);
+        }
+        catch (...)
+        {
+            txn.abort();
+            throw;
+        }
+        commit(txn);
+        return true;
+    }
+
+    // re-indexes a document under a new id, or adds it if it doesn't exist yet. atomic, readers see either version
+    void replace_document(const std::string& name, const void* ptr, std::size_t size)
+    {
+        if (!fits_memory_budget(size))
+        {
+            MemoryChunks chunks{ptr, size, stream_chunk_size};
+            replace_document_chunks(name, chunks);
+            return;
+        }
+
+        auto tokens = tokenize(ptr, size, _stage_stats);
+
+        Txn txn{_env};
+        try
+        {
+            remove_document(txn, name);
+            put_document(txn, name, ptr, size, tokens);
+        }
+        catch (...)
+        {
+            txn.abort();
+            throw;
+        }
+        commit(txn);
+    }
+
+    void replace_document(const std::string& name, const std::string& file_path)
+    {
+        if (!fits_memory_budget(std::filesystem::file_size(file_path)))
+        {
+            File file{file_path};
+            FdChunks chunks{file.fd, stream_chunk_size, _stage_stats};
+            replace_document_chunks(name, chunks);
+            return;
+        }
+
+        StageTimer read_timer{_stage_stats, IngestStats::Read};
+        Mmap mmap{file_path};
+        read_timer.stop();
+        replace_document(name, mmap.ptr(), mmap.size());
+    }
+
+    // removes a document inside an existing write transaction. postings are found through the document's term
+    // list, only the blocks holding them are rewritten
+    bool remove_document(Txn& txn, const std::string& name)
+    {
+        KeyVal<char, uint32_t> id{{name}, {}};
+        if (!txn.try_get(_dbi_document_id, id).found())
+            return false;
+        uint32_t doc_id = *id.val.data();
+
+        std::string terms;
+        if (!term_list(txn, _dbi_document_terms, doc_id, terms))
+            throw std::runtime_error{"document " + name + " was indexed without a term list, rebuild the index"};
+
+        Cursor c{txn, _dbi_word_idx, true};
+        for (std::size_t start = 0; start < terms.size();)
+        {
+            auto end = terms.find('\0', start);
+            std::string_view term{&terms[start], end - start};
+            start = end + 1;
+
+            auto stats = word_stats(txn, term);
+            stats.occurrences -= postings::remove(c, term, doc_id);
+            stats.documents -= 1;
+            if (stats.documents)
+                txn.put(_dbi_word_stats, Val<char>{term}, Val<TermStats>{&stats});
+            else
+                txn.del(_dbi_word_stats, Val<char>{term});
         }
 
+        std::string readings;
+        if (term_list(txn, _dbi_document_readings, doc_id, readings))
         {
-            Txn txn{_env, 0, true};
-            Cursor c{txn, _dbi_word_idx, true};
-            Val<char> k;
-            MultiVal<WordIdx> v;
-            for (const auto& wloc : word_locations)
+            Cursor rc{txn, _dbi_reading_idx, true};
+            for (std::size_t start = 0; start < readings.size();)
             {
-                k = Val<char>{wloc.first};
-                v = MultiVal<WordIdx>{wloc.second};
-                c.put(k, v, MDB_MULTIPLE);
+                auto end = readings.find('\0', start);
+                postings::remove(rc, std::string_view{&readings[start], end - start}, doc_id);
+                start = end + 1;
             }
+            txn.del(_dbi_document_readings, Val<uint32_t>{&doc_id});
         }
 
+        remove_document_length(txn, doc_id);
+        Val<uint32_t> key{&doc_id};
+        txn.del(_dbi_document_terms, key);
+        KeyVal<uint32_t, char> content{{&doc_id}, {}};
+        if (txn.try_get(_dbi_document_content, content).found())
+            txn.del(_dbi_document_content, key);
+        else
+            remove_document_chunks(txn, doc_id);
+        txn.del(_dbi_document_info, key);
+        txn.del(_dbi_document_id, Val<char>{name});
         return true;
     }
 
+    MDB_env* env() const
+    {
+        return _env;
+    }
+
+    // whether following ingests time their stages, the counters are always kept
+    void time_ingest_stages(bool on)
+    {
+        _stage_stats = on ? &_stats : nullptr;
+    }
+
+    // for StageTimers of ingest work done elsewhere, nullptr unless stages are timed
+    IngestStats* stage_stats() const
+    {
+        return _stage_stats;
+    }
+
+    // of the ingests since the db was opened
+    const IngestStats& ingest_stats() const
+    {
+        return _stats;
+    }
+
+    // of all committed ingests into the db, stage times only of those that timed them
+    IngestStats::Fields ingest_totals()
+    {
+        auto txn = read_txn();
+        return ingest_totals(txn);
+    }
+
+    MDB_envinfo env_info() const
+    {
+        return _env.info();
+    }
+
+    // page usage of the main db, which holds the others, then of each dbi
+    template <typename F>
+    void table_stats(F&& f)
+    {
+        f("(main)", _env.stat());
+        auto txn = read_txn();
+        const std::pair<const char*, MDB_dbi> dbis[] = {
+            {"meta", _dbi_meta},
+            {"document_id", _dbi_document_id},
+            {"document_content", _dbi_document_content},
+            {"document_chunks", _dbi_document_chunks},
+            {"document_info", _dbi_document_info},
+            {"document_length", _dbi_document_length},
+            {"document_terms", _dbi_document_terms},
+            {"word_idx", _dbi_word_idx},
+            {"word_stats", _dbi_word_stats},
+            {"reading_idx", _dbi_reading_idx},
+            {"document_readings", _dbi_document_readings},
+        };
+        for (auto& [name, dbi] : dbis) f(name, Dbi::stat(txn, dbi));
+    }
+
+    // indexed words over all documents
+    uint64_t token_count()
+    {
+        auto txn = read_txn();
+        KeyVal<char, uint64_t> kv{{ranking::total_length_key}, {}};
+        if (!txn.try_get(_dbi_meta, kv).found())
+            return 0;
+        uint64_t total;
+        std::memcpy(&total, kv.val.data(), sizeof(total));
+        return total;
+    }
+
+    // big files are read in chunks instead of mapped, so they don't have to fit in memory either
     bool add_document(const std::string& name, const std::string& file_path)
     {
+        if (!fits_memory_budget(std::filesystem::file_size(file_path)))
+        {
+            File file{file_path};
+            return add_document_stream(name, file.fd);
+        }
+
+        StageTimer read_timer{_stage_stats, IngestStats::Read};
         Mmap mmap{file_path};
+        read_timer.stop();
         return add_document(name, mmap.ptr(), mmap.size());
     }
 
     auto word_indices(const std::string& word)
     {
-        return MultipleValueIteratable<char, WordIdx>{_env, _dbi_word_idx, Val<char>{word}};
+        return postings::PostingIteratable{read_txn(), _dbi_word_idx, word};
+    }
+
+    // postings of all words read as reading, which may be given in hiragana or katakana
+    auto reading_indices(const std::string& reading)
+    {
+        return postings::PostingIteratable{read_txn(), _dbi_reading_idx, tagging::to_katakana(reading)};
+    }
+
+    // calls f(std::string_view) with the document's text, in order. once for documents added in one piece,
+    // once per chunk for streamed ones
+    template <typename F>
+    void document_text(const std::string& name, F&& f)
+    {
+        auto txn = read_txn();
+        auto doc_id = document_id(txn, name);
+        KeyVal<uint32_t, char> kv{{&doc_id}, {}};
+        if (txn.try_get(_dbi_document_content, kv).found())
+        {
+            f(val_to_string_view(kv.val));
+            return;
+        }
+
+        ChunkKey first{doc_id, 0};
+        Cursor c{txn, _dbi_document_chunks, true};
+        Val<uint8_t> k{first.bytes, sizeof(first.bytes)};
+        Val<char> v;
+        for (auto status = c.try_get(k, v, MDB_SET_RANGE); status.found() && ChunkKey::doc(k) == doc_id;
+             status = c.try_get(k, v, MDB_NEXT))
+        {
+            f(val_to_string_view(v));
+        }
     }
 
+    // only for documents added in one piece, see document_text
     ValueView<char> view_document(const std::string& name)
     {
-        auto hash = strhash(name.c_str());
-        return ValueView<char>{_env, _dbi_document_content, Val<decltype(hash)>{&hash}};
+        auto txn = read_txn();
+        auto doc_id = document_id(txn, name);
+        return ValueView<char>{std::move(txn), _dbi_document_content, Val<decltype(doc_id)>{&doc_id}};
+    }
+
+    // a pooled read transaction, for several lookups on one snapshot:
+    //   auto txn = lft.read_txn();
+    //   auto a = lft.word_stats(txn, "猫"), b = lft.word_stats(txn, "犬");
+    Txn read_txn()
+    {
+        return _read_txns.acquire();
+    }
+
+    uint32_t document_id(const std::string& name)
+    {
+        auto txn = read_txn();
+        return document_id(txn, name);
+    }
+
+    uint32_t document_id(Txn& txn, const std::string& name)
+    {
+        KeyVal<char, uint32_t> kv{{name}, {}};
+        txn.get(_dbi_document_id, kv);
+        return *kv.val.data();
     }
 
     size_t word_occurrence_count(const std::string& word)
     {
-        size_t count = 0;
-        KeyVal<char, WordIdx> kv{{word}, {}};
-        Txn txn{_env, MDB_RDONLY, true};
-        Cursor c{txn, _dbi_word_idx, true};
-        try
+        return word_stats(word).occurrences;
+    }
+
+    TermStats word_stats(const std::string& word)
+    {
+        auto txn = read_txn();
+        return word_stats(txn, word);
+    }
+
+    // boolean query over word base forms, e.g. "猫 AND (犬 OR 鳥) NOT 魚". adjacent terms are ANDed.
+    // "..." matches a phrase, a NEAR/k b matches a and b at most k words apart
+    auto search(const std::string& expression)
+    {
+        return query::QueryIteratable{read_txn(), query_dbis(), expression};
+    }
+
+    // the k best documents matching expression by BM25 over its words, best first.
+    // use OR between words for a plain bag of words search
+    auto search_top(const std::string& expression, std::size_t k)
+    {
+        return ranking::TopK{read_txn(), query_dbis(), expression, k};
+    }
+
+    struct Example
+    {
+        uint32_t doc;
+        std::string_view document_name;
+        kwic::Context context;
+    };
+
+    // calls f(const Example&) for up to limit occurrences of word, with width characters of context on either side.
+    // everything is read in one transaction and the views point straight into the map, so they are only valid
+    // during the call. returns the number of examples
+    template <typename F>
+    std::size_t word_examples(const std::string& word, std::size_t width, std::size_t limit, F&& f)
+    {
+        auto txn = read_txn();
+        postings::PostingCursor c{txn, _dbi_word_idx, word};
+
+        std::size_t n = 0;
+        uint32_t doc_id = 0;
+        Example example{};
+        std::string_view content;
+        uint32_t content_start = 0;  // content's offset in the document, it's a single chunk of streamed ones
+        for (; c.valid() && n < limit; c.next(), ++n)
         {
-            c.get(kv, MDB_SET);
-            c.get(kv, MDB_GET_MULTIPLE);
-            while (true)
+            auto idx = c.current();
+            if (idx.doc() != doc_id)
             {
-                count += kv.val.size() / sizeof(WordIdx);
-                c.get(kv, MDB_NEXT_MULTIPLE);
+                doc_id = idx.doc();
+                KeyVal<uint32_t, char> info{{&doc_id}, {}};
+                txn.get(_dbi_document_info, info);
+                example.doc = doc_id;
+                example.document_name = val_to_string_view(info.val);
+                content = document_content(txn, doc_id, idx.location(), content_start);
             }
+            else if (idx.location() < content_start || idx.location() - content_start >= content.size())
+            {
+                content = document_content(txn, doc_id, idx.location(), content_start);
+            }
+            example.context = kwic::slice(content, idx.location() - content_start, width);
+            f(example);
         }
-        catch (NotFoundError& e)
-        {
-        }
-        return count;
+        return n;
     }
 
     auto word_list()
     {
-        return KeyIteratable<char>{_env, _dbi_word_idx};
+        return KeyIteratable<char>{read_txn(), _dbi_word_idx};
+    }
+
+    // words matching a wildcard pattern like 食べ*, see query::expand
+    template <typename F>
+    void word_list(const std::string& pattern, F&& f)
+    {
+        auto txn = read_txn();
+        query::expand(txn, _dbi_word_stats, pattern, f);
+    }
+
+    // words that have been tagged as pos, from word_stats
+    template <typename F>
+    void word_list(tagging::Pos pos, F&& f)
+    {
+        for (auto& kv : KeyValIteratable<char, TermStats>{read_txn(), _dbi_word_stats})
+        {
+            TermStats stats;
+            std::memcpy(&stats, kv.val.data(), sizeof(stats));
+            if (stats.documents && stats.pos_mask & 1u << (uint8_t)pos)
+                f(val_to_string_view(kv.key));
+        }
     }
 
     auto document_list()
     {
-        return KeyValIteratable<uint32_t, char>{_env, _dbi_document_info};
+        return KeyValIteratable<uint32_t, char>{read_txn(), _dbi_document_info};
     }
 
     void test()
@@ -168,26 +725,528 @@ public:
         */
     }
 
-    std::string document_info(uint32_t hash)
+    std::string document_info(uint32_t doc_id)
     {
-        Txn txn{_env, MDB_RDONLY, true};
-        KeyVal<decltype(hash), char> kv{{&hash, sizeof(hash)}, {}};
+        auto txn = read_txn();
+        return std::string{document_name(txn, doc_id)};
+    }
+
+    // points into the map, valid while txn is
+    std::string_view document_name(Txn& txn, uint32_t doc_id)
+    {
+        KeyVal<decltype(doc_id), char> kv{{&doc_id, sizeof(doc_id)}, {}};
         txn.get(_dbi_document_info, kv);
-        return kv.val.to_str();
+        return val_to_string_view(kv.val);
+    }
+
+    TermStats word_stats(Txn& txn, std::string_view word)
+    {
+        KeyVal<char, TermStats> kv{{word}, {}};
+        if (!txn.try_get(_dbi_word_stats, kv).found())
+            return TermStats{0, 0, 0};
+        TermStats stats;
+        std::memcpy(&stats, kv.val.data(), sizeof(stats));
+        return stats;
     }
 
 private:
-    uint32_t strhash(const std::string& str) const
+    // counts the commit and the pages it added to the file. the stats since the last commit go into the meta dbi's
+    // totals in the same transaction, so a commit's own time and pages are recorded with the next one
+    void commit(Txn& txn)
+    {
+        auto recorded = record_ingest_stats(txn);
+        auto last_page = _env.info().me_last_pgno;
+        StageTimer timer{_stage_stats, IngestStats::Commit};
+        txn.commit();
+        timer.stop();
+        _recorded = recorded;
+        _stats.commits += 1;
+        _stats.pages += _env.info().me_last_pgno - last_page;
+    }
+
+    // adds what's changed since the last recorded stats to the totals, returns the stats recorded
+    IngestStats::Fields record_ingest_stats(Txn& txn)
+    {
+        auto now = _stats.fields();
+        if (now == _recorded)
+            return now;
+
+        auto totals = ingest_totals(txn);
+        for (std::size_t i = 0; i < totals.size(); ++i) totals[i] += now[i] - _recorded[i];
+        txn.put(_dbi_meta, Val<char>{_ingest_stats_key}, Val<uint64_t>{totals.data(), sizeof(totals)});
+        return now;
+    }
+
+    // what's left after the last commit, at the cost of another one
+    void flush_ingest_stats()
+    {
+        if (_read_only || _stats.fields() == _recorded)
+            return;
+        Txn txn{_env};
+        _recorded = record_ingest_stats(txn);
+        txn.commit();
+    }
+
+    IngestStats::Fields ingest_totals(Txn& txn)
+    {
+        IngestStats::Fields totals{};
+        KeyVal<char, uint64_t> kv{{_ingest_stats_key}, {}};
+        if (txn.try_get(_dbi_meta, kv).found() && kv.val.size() == sizeof(totals))
+            std::memcpy(totals.data(), kv.val.data(), sizeof(totals));
+        return totals;
+    }
+
+    // allocates the next document id and maps name <-> id
+    bool put_document_info(Txn& txn, uint32_t& doc_id, const std::string& name)
+    {
+        doc_id = next_document_id(txn);
+        try
+        {
+            txn.put(_dbi_document_id, Val<char>{name}, Val<uint32_t>{&doc_id}, MDB_NOOVERWRITE);
+        }
+        catch (KeyExistsError& e)
+        {
+            std::cout << "document " << name << " already exists" << std::endl;  // TODO
+            return false;
+        }
+
+        uint32_t next_id = doc_id + 1;
+        txn.put(_dbi_meta, Val<char>{_next_document_id_key}, Val<uint32_t>{&next_id});
+
+        KeyVal<uint32_t, char> kv{{&doc_id, sizeof(doc_id)}, {name}};
+        txn.put(_dbi_document_info, kv, MDB_NOOVERWRITE);
+        return true;
+    }
+
+    // document_chunks key: doc id and the end offset of the chunk in the document, big-endian, so a document's
+    // chunks are adjacent and in order, and MDB_SET_RANGE on {doc id, location + 1} finds location's chunk
+    struct ChunkKey
     {
-        std::hash<std::string> hash_fn;
-        auto h = hash_fn(str);
-        return (uint32_t)h;
+        uint8_t bytes[8];
+
+        ChunkKey(uint32_t doc_id, uint32_t end)
+        {
+            postings::block::store_be64(bytes, (uint64_t)doc_id << 32 | end);
+        }
+
+        static uint32_t doc(const Val<uint8_t>& key)
+        {
+            return postings::block::load_be64(key.data()) >> 32;
+        }
+
+        static uint32_t end(const Val<uint8_t>& key)
+        {
+            return (uint32_t)postings::block::load_be64(key.data());
+        }
+    };
+
+    // the text of the document around location: all of it, or the chunk holding location if it was streamed.
+    // chunks end on a newline, so they hold the location's whole line. start is where the text begins in the document
+    std::string_view document_content(Txn& txn, uint32_t doc_id, uint32_t location, uint32_t& start)
+    {
+        start = 0;
+        KeyVal<uint32_t, char> kv{{&doc_id}, {}};
+        if (txn.try_get(_dbi_document_content, kv).found())
+            return val_to_string_view(kv.val);
+
+        ChunkKey probe{doc_id, location + 1};
+        Cursor c{txn, _dbi_document_chunks, true};
+        Val<uint8_t> k{probe.bytes, sizeof(probe.bytes)};
+        Val<char> v;
+        if (!c.try_get(k, v, MDB_SET_RANGE).found() || ChunkKey::doc(k) != doc_id)
+            return {};
+        start = ChunkKey::end(k) - v.size();
+        return val_to_string_view(v);
     }
 
+    void remove_document_chunks(Txn& txn, uint32_t doc_id)
+    {
+        ChunkKey first{doc_id, 0};
+        Cursor c{txn, _dbi_document_chunks, true};
+        Val<uint8_t> k{first.bytes, sizeof(first.bytes)};
+        Val<> v;
+        // after a del the cursor already is on the next entry, which MDB_NEXT then returns
+        for (auto status = c.try_get(k, v, MDB_SET_RANGE); status.found() && ChunkKey::doc(k) == doc_id;
+             status = c.try_get(k, v, MDB_NEXT))
+        {
+            c.del();
+        }
+    }
+
+    // a file opened for reading, closed with it
+    struct File
+    {
+        int fd;
+
+        File(const std::string& path)
+            : fd(open(path.c_str(), O_RDONLY))
+        {
+            if (fd < 0)
+                throw std::system_error{errno, std::generic_category(), "couldn't open " + path};
+        }
+
+        ~File()
+        {
+            close(fd);
+        }
+    };
+
+    // a document in memory as chunks of whole lines of at least chunk_size bytes, or whatever is left at the end
+    class MemoryChunks
+    {
+    public:
+        MemoryChunks(const void* ptr, std::size_t size, std::size_t chunk_size)
+            : _text{(const char*)ptr, size}
+            , _chunk_size(chunk_size)
+        {
+        }
+
+        bool next(std::string_view& chunk)
+        {
+            if (_offset == _text.size())
+                return false;
+            auto newline = _text.find('\n', std::min(_offset + _chunk_size, _text.size()) - 1);
+            auto end = newline == std::string_view::npos ? _text.size() : newline + 1;
+            chunk = _text.substr(_offset, end - _offset);
+            _offset = end;
+            return true;
+        }
+
+    private:
+        std::string_view _text;
+        std::size_t _chunk_size;
+        std::size_t _offset = 0;
+    };
+
+    // the same read from fd until EOF. a chunk is valid until the next one is asked for
+    class FdChunks
+    {
+    public:
+        FdChunks(int fd, std::size_t chunk_size, IngestStats* stats)
+            : _fd(fd)
+            , _chunk_size(chunk_size)
+            , _stats(stats)
+        {
+        }
+
+        bool next(std::string_view& chunk)
+        {
+            _buffer.erase(0, _consumed);
+            _scanned = 0;
+
+            std::size_t end = 0;
+            while (true)
+            {
+                if (_buffer.size() >= _chunk_size)
+                {
+                    auto newline = std::string_view{_buffer}.substr(_scanned).rfind('\n');
+                    if (newline != std::string_view::npos)
+                    {
+                        end = _scanned + newline + 1;
+                        break;
+                    }
+                    _scanned = _buffer.size();
+                }
+                if (_eof)
+                {
+                    end = _buffer.size();
+                    break;
+                }
+                StageTimer read_timer{_stats, IngestStats::Read};
+                _eof = !read_some(_chunk_size);
+            }
+
+            _consumed = end;
+            chunk = std::string_view{_buffer.data(), end};
+            return end > 0;
+        }
+
+    private:
+        // appends up to n bytes, false at EOF
+        bool read_some(std::size_t n)
+        {
+            auto size = _buffer.size();
+            _buffer.resize(size + n);
+            ssize_t got;
+            do
+            {
+                got = read(_fd, &_buffer[size], n);
+            } while (got < 0 && errno == EINTR);
+            _buffer.resize(size + (got > 0 ? got : 0));
+            if (got < 0)
+                throw std::system_error{errno, std::generic_category(), "read"};
+            return got > 0;
+        }
+
+        int _fd;
+        std::size_t _chunk_size;
+        IngestStats* _stats;
+        std::string _buffer;
+        std::size_t _consumed = 0;  // by the last chunk
+        std::size_t _scanned = 0;   // of the buffer, known to have no newline
+        bool _eof = false;
+    };
+
+    template <typename Chunks>
+    bool add_document_chunks(const std::string& name, Chunks& chunks)
+    {
+        Txn txn{_env};
+        try
+        {
+            if (!put_document_chunks(txn, name, chunks))
+            {
+                txn.abort();
+                return false;
+            }
+        }
+        catch (...)
+        {
+            txn.abort();
+            throw;
+        }
+        commit(txn);
+        return true;
+    }
+
+    template <typename Chunks>
+    void replace_document_chunks(const std::string& name, Chunks& chunks)
+    {
+        Txn txn{_env};
+        try
+        {
+            remove_document(txn, name);
+            put_document_chunks(txn, name, chunks);
+        }
+        catch (...)
+        {
+            txn.abort();
+            throw;
+        }
+        commit(txn);
+    }
+
+    // stores a document chunk by chunk. its postings are collected across chunks within the memory budget, and
+    // written term by term once it's all read
+    template <typename Chunks>
+    bool put_document_chunks(Txn& txn, const std::string& name, Chunks& chunks)
+    {
+        uint32_t doc_id;
+        if (!put_document_info(txn, doc_id, name))
+            return false;
+
+        postings::PostingRuns words{_memory_budget / 2};
+        postings::PostingRuns readings{_memory_budget / 2};
+        uint64_t location = 0;
+        uint32_t position = 0;
+        auto collect = [&](const TermLocations& locations, postings::PostingRuns& runs) {
+            for (const auto& loc : locations)
+            {
+                for (auto occurrence : loc.second)
+                {
+                    runs.add(loc.first, WordIdx{doc_id, (uint32_t)location + occurrence.location,
+                                                position + occurrence.position, (uint8_t)occurrence.pos});
+                }
+            }
+        };
+        for (std::string_view chunk; chunks.next(chunk);)
+        {
+            if (location + chunk.size() > UINT32_MAX)
+                throw std::runtime_error{"document " + name + " is larger than 4gib"};
+
+            auto tokens = tokenize(chunk.data(), chunk.size(), _stage_stats);
+            StageTimer term_map_timer{_stage_stats, IngestStats::TermMap};
+            collect(tokens.words, words);
+            collect(tokens.readings, readings);
+            term_map_timer.stop();
+
+            StageTimer write_timer{_stage_stats, IngestStats::Write};
+            location += chunk.size();
+            position += word_count(tokens.words);
+            ChunkKey key{doc_id, (uint32_t)location};
+            txn.put(_dbi_document_chunks, Val<uint8_t>{key.bytes, sizeof(key.bytes)}, Val<char>{chunk});
+        }
+
+        StageTimer write_timer{_stage_stats, IngestStats::Write};
+        put_document_length(txn, doc_id, position);
+        auto terms = put_runs(txn, _dbi_word_idx, _dbi_document_terms, doc_id, words, true);
+        auto reading_terms = put_runs(txn, _dbi_reading_idx, _dbi_document_readings, doc_id, readings, false);
+
+        _stats.documents += 1;
+        _stats.bytes += location;
+        _stats.tokens += position;
+        _stats.terms += terms;
+        _stats.readings += reading_terms;
+        return true;
+    }
+
+    // per document token count plus the running total used for the average document length
+    static uint32_t word_count(const TermLocations& word_locations)
+    {
+        uint32_t n = 0;
+        for (const auto& wloc : word_locations) n += wloc.second.size();
+        return n;
+    }
+
+    void put_document_length(Txn& txn, uint32_t doc_id, uint32_t length)
+    {
+        txn.put(_dbi_document_length, Val<uint32_t>{&doc_id}, Val<uint32_t>{&length});
+
+        uint64_t total = length;
+        KeyVal<char, uint64_t> kv{{ranking::total_length_key}, {}};
+        if (txn.try_get(_dbi_meta, kv).found())
+            total += *kv.val.data();
+        txn.put(_dbi_meta, Val<char>{ranking::total_length_key}, Val<uint64_t>{&total});
+    }
+
+    void remove_document_length(Txn& txn, uint32_t doc_id)
+    {
+        KeyVal<uint32_t, uint32_t> length{{&doc_id}, {}};
+        if (!txn.try_get(_dbi_document_length, length).found())
+            return;
+        uint64_t removed = *length.val.data();
+        txn.del(_dbi_document_length, length.key);
+
+        KeyVal<char, uint64_t> kv{{ranking::total_length_key}, {}};
+        txn.get(_dbi_meta, kv);
+        uint64_t total = *kv.val.data() - removed;
+        txn.put(_dbi_meta, Val<char>{ranking::total_length_key}, Val<uint64_t>{&total});
+    }
+
+    query::Dbis query_dbis() const
+    {
+        return {_dbi_word_idx, _dbi_word_stats, _dbi_document_info, _dbi_document_length, _dbi_meta};
+    }
+
+    static std::string bulk_lock_path(const std::string& db_path)
+    {
+        return (std::filesystem::path{db_path} / "bulk.lock").string();
+    }
+
+    // a bulk load marker is fine while its loader runs, readers and writers can go on next to it. without a loader
+    // holding the lock, it was left by a crash. holding a shared lock keeps a new bulk load from setting the marker
+    // again while it's read once more, the loader may just have finished
+    void check_bulk_load(const std::string& db_path)
+    {
+        int fd = open(bulk_lock_path(db_path).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd >= 0 && flock(fd, LOCK_SH | LOCK_NB) < 0)
+        {
+            int error = errno;
+            close(fd);
+            if (error == EWOULDBLOCK)
+                return;
+            throw std::system_error{error, std::generic_category(), "couldn't lock " + bulk_lock_path(db_path)};
+        }
+
+        auto txn = read_txn();
+        KeyVal<char, char> marker{{_bulk_load_key}, {}};
+        bool marked = txn.try_get(_dbi_meta, marker).found();
+        txn.abort();
+        if (fd >= 0)
+            close(fd);
+        if (marked)
+            throw std::runtime_error{db_path + " has an unfinished bulk load and no loader, it has to be rebuilt"};
+    }
+
+    // ids are handed out sequentially starting at 1 and never reused
+    uint32_t next_document_id(Txn& txn)
+    {
+        KeyVal<char, uint32_t> kv{{_next_document_id_key}, {}};
+        if (!txn.try_get(_dbi_meta, kv).found())
+            return 1;
+        return *kv.val.data();
+    }
+
+    // appends a term's postings in the document, word_stats are kept if stats is set.
+    // first says whether they are the document's first postings of term
+    void append_postings(Txn& txn, Cursor& c, std::string_view term, std::span<const WordIdx> indices, bool first,
+                         bool stats)
+    {
+        postings::append(c, term, indices);
+        if (!stats)
+            return;
+
+        auto term_stats = word_stats(txn, term);
+        term_stats.occurrences += indices.size();
+        term_stats.documents += first;
+        for (auto& idx : indices) term_stats.pos_mask |= 1u << idx.pos;
+        txn.put(_dbi_word_stats, Val<char>{term}, Val<TermStats>{&term_stats});
+    }
+
+    // a document's postings into idx_dbi and its '\0' separated term list into list_dbi
+    void put_locations(Txn& txn, MDB_dbi idx_dbi, MDB_dbi list_dbi, uint32_t doc_id, const TermLocations& locations,
+                       bool stats)
+    {
+        Cursor c{txn, idx_dbi, true};
+        std::vector<WordIdx> indices;
+        std::string list;
+        for (const auto& loc : locations)
+        {
+            list.append(loc.first).push_back('\0');
+            indices.clear();
+            for (auto occurrence : loc.second)
+            {
+                indices.emplace_back(doc_id, occurrence.location, occurrence.position, (uint8_t)occurrence.pos);
+            }
+            append_postings(txn, c, loc.first, indices, true, stats);
+        }
+        txn.put(list_dbi, Val<uint32_t>{&doc_id}, Val<char>{list});
+    }
+
+    // the same from the postings collected by put_document_chunks, returns the number of distinct terms
+    std::size_t put_runs(Txn& txn, MDB_dbi idx_dbi, MDB_dbi list_dbi, uint32_t doc_id, postings::PostingRuns& runs,
+                         bool stats)
+    {
+        Cursor c{txn, idx_dbi, true};
+        std::string list;
+        std::size_t terms = 0;
+        runs.for_each([&](std::string_view term, std::span<const WordIdx> indices, bool first) {
+            if (first)
+            {
+                list.append(term).push_back('\0');
+                ++terms;
+            }
+            append_postings(txn, c, term, indices, first, stats);
+        });
+        txn.put(list_dbi, Val<uint32_t>{&doc_id}, Val<char>{list});
+        return terms;
+    }
+
+    // copies a document's '\0' separated term list out of the map, which later writes may change
+    bool term_list(Txn& txn, MDB_dbi dbi, uint32_t doc_id, std::string& out)
+    {
+        KeyVal<uint32_t, char> kv{{&doc_id}, {}};
+        if (!txn.try_get(dbi, kv).found())
+            return false;
+        out = val_to_string_view(kv.val);
+        return true;
+    }
+
+    static constexpr std::string_view _next_document_id_key = "next_document_id";
+    // IngestStats::Fields summed over all commits
+    static constexpr std::string_view _ingest_stats_key = "ingest_stats";
+    // set while a bulk load runs, see the constructor
+    static constexpr std::string_view _bulk_load_key = "bulk_load";
+
     Env _env;
+    ReadTxnPool _read_txns{_env};
+    IngestStats _stats;
+    IngestStats* _stage_stats = nullptr;  // &_stats while timing stages
+    IngestStats::Fields _recorded{};      // of _stats, in the meta dbi
+    bool _read_only;
+    std::size_t _memory_budget = default_memory_budget;
+    bool _bulk = false;
+    int _bulk_lock = -1;  // flock held during a bulk load
+    Dbi _dbi_meta;
+    Dbi _dbi_document_id;
     Dbi _dbi_word_idx;
+    Dbi _dbi_word_stats;
+    Dbi _dbi_reading_idx;
+    Dbi _dbi_document_readings;
     Dbi _dbi_document_info;
+    Dbi _dbi_document_length;
+    Dbi _dbi_document_terms;
     Dbi _dbi_document_content;
+    Dbi _dbi_document_chunks;
 };
 
 #endif
@@ -2,6 +2,7 @@
 #define __lmdbpp
 
 #include <lmdb.h>
+#include <mutex>
 #include <stdexcept>
 #include <string_view>
 #include <unordered_map>
@@ -83,6 +84,46 @@ void check(int return_code)
         throw Error(return_code);
 }
 
+// return code of the non-throwing try_* calls, for loops that end on MDB_NOTFOUND without unwinding
+class Status
+{
+public:
+    Status(int code = MDB_SUCCESS)
+        : code(code)
+    {
+    }
+
+    bool ok() const
+    {
+        return code == MDB_SUCCESS;
+    }
+
+    bool not_found() const
+    {
+        return code == MDB_NOTFOUND;
+    }
+
+    explicit operator bool() const
+    {
+        return ok();
+    }
+
+    // true on success, false on MDB_NOTFOUND, throws like the throwing API for anything else
+    bool found() const
+    {
+        if (code != MDB_SUCCESS && code != MDB_NOTFOUND)
+            lmdbpp::check(code);
+        return code == MDB_SUCCESS;
+    }
+
+    void check() const
+    {
+        lmdbpp::check(code);
+    }
+
+    int code;
+};
+
 template <typename T = void>
 class Val
 {
@@ -105,6 +146,11 @@ public:
     {
     }
 
+    Val(std::string_view str)
+        : _val{str.length(), (void*)str.data()}
+    {
+    }
+
     Val(const Val& o) = default;
 
     T* data() const
@@ -216,6 +262,27 @@ public:
         check(mdb_env_open(_env, path.c_str(), flags, mode));
     }
 
+    // flushes commits the env's flags left to the os, e.g. with MDB_NOSYNC. force also waits on MDB_MAPASYNC writes
+    void sync(bool force = true)
+    {
+        check(mdb_env_sync(_env, force));
+    }
+
+    // of the main db, which holds the named dbis
+    MDB_stat stat() const
+    {
+        MDB_stat st;
+        check(mdb_env_stat(_env, &st));
+        return st;
+    }
+
+    MDB_envinfo info() const
+    {
+        MDB_envinfo info;
+        check(mdb_env_info(_env, &info));
+        return info;
+    }
+
     operator MDB_env*() const
     {
         return _env;
@@ -275,6 +342,13 @@ public:
         return flags(txn, _dbi);
     }
 
+    static MDB_stat stat(MDB_txn* txn, MDB_dbi dbi)
+    {
+        MDB_stat st;
+        check(mdb_stat(txn, dbi, &st));
+        return st;
+    }
+
 private:
     MDB_dbi _dbi = -1;
     MDB_env* _env = nullptr;
@@ -335,6 +409,27 @@ public:
         get(kv.key, kv.val, op);
     }
 
+    Status try_get(MDB_val* key, MDB_val* val, MDB_cursor_op op) noexcept
+    {
+        return mdb_cursor_get(_cursor, key, val, op);
+    }
+
+    Status try_get(MDB_val* key, MDB_cursor_op op) noexcept
+    {
+        return try_get(key, nullptr, op);
+    }
+
+    template <typename TKey, typename TVal>
+    Status try_get(KeyVal<TKey, TVal>& kv, MDB_cursor_op op) noexcept
+    {
+        return try_get(kv.key, kv.val, op);
+    }
+
+    void del(unsigned int flags = 0)
+    {
+        check(mdb_cursor_del(_cursor, flags));
+    }
+
     Cursor& operator=(Cursor&& o)
     {
         std::swap(_txn, o._txn);
@@ -362,6 +457,8 @@ private:
     bool _autoclose = false;
 };
 
+class ReadTxnPool;
+
 class Txn
 {
 public:
@@ -376,17 +473,14 @@ public:
         check(mdb_txn_begin(_env, nullptr, flags, &_txn));
     };
 
-    ~Txn()
-    {
-        if (_autocommit && _txn != nullptr)
-            commit();
-    }
+    ~Txn();
 
     Txn& operator=(Txn&& o)
     {
         std::swap(_env, o._env);
         std::swap(_txn, o._txn);
         std::swap(_autocommit, o._autocommit);
+        std::swap(_pool, o._pool);
         return *this;
     }
 
@@ -395,6 +489,7 @@ public:
         std::swap(_env, o._env);
         std::swap(_txn, o._txn);
         std::swap(_autocommit, o._autocommit);
+        std::swap(_pool, o._pool);
     }
 
     Txn(Txn& o)
@@ -402,16 +497,24 @@ public:
         std::swap(_env, o._env);
         std::swap(_txn, o._txn);
         std::swap(_autocommit, o._autocommit);
+        std::swap(_pool, o._pool);
     }
 
+    // pooled transactions go back to their pool instead
     void commit()
     {
-        check(mdb_txn_commit(_txn));
+        if (_pool)
+            release();
+        else
+            check(mdb_txn_commit(_txn));
     }
 
     void abort()
     {
-        mdb_txn_abort(_txn);
+        if (_pool)
+            release();
+        else
+            mdb_txn_abort(_txn);
     }
 
     void get(MDB_dbi dbi, MDB_val* key, MDB_val* val)
@@ -430,6 +533,17 @@ public:
         get(dbi, kv.key, kv.val);
     }
 
+    Status try_get(MDB_dbi dbi, MDB_val* key, MDB_val* val) noexcept
+    {
+        return mdb_get(_txn, dbi, key, val);
+    }
+
+    template <typename TKey, typename TVal>
+    Status try_get(MDB_dbi dbi, KeyVal<TKey, TVal>& kv) noexcept
+    {
+        return try_get(dbi, kv.key, kv.val);
+    }
+
     void put(MDB_dbi dbi, MDB_val* key, MDB_val* val, unsigned int flags = 0)
     {
         check(mdb_put(_txn, dbi, key, val, flags));
@@ -441,6 +555,12 @@ public:
         put(dbi, kv.key, kv.val, flags);
     }
 
+    // val only matters for MDB_DUPSORT dbis, where it selects the duplicate to delete
+    void del(MDB_dbi dbi, MDB_val* key, MDB_val* val = nullptr)
+    {
+        check(mdb_del(_txn, dbi, key, val));
+    }
+
     Dbi open_dbi(const char* name, unsigned int flags = 0)
     {
         return Dbi(_env, _txn, name, flags);
@@ -467,11 +587,99 @@ public:
     }
 
 private:
+    friend class ReadTxnPool;
+    void release();
+
     MDB_txn* _txn = nullptr;
     MDB_env* _env = nullptr;
     bool _autocommit = false;
+    ReadTxnPool* _pool = nullptr;
+};
+
+// keeps ended read transactions around for reuse. mdb_txn_reset drops a transaction's snapshot but keeps its
+// reader slot, mdb_txn_renew takes a fresh snapshot, which is much cheaper than mdb_txn_begin.
+// transactions move between threads, so the env has to be opened with MDB_NOTLS
+class ReadTxnPool
+{
+public:
+    ReadTxnPool(MDB_env* env)
+        : _env(env)
+    {
+    }
+
+    ReadTxnPool(const ReadTxnPool&) = delete;
+    ReadTxnPool& operator=(const ReadTxnPool&) = delete;
+
+    ~ReadTxnPool()
+    {
+        for (auto txn : _idle) mdb_txn_abort(txn);
+    }
+
+    // a read transaction on the latest snapshot, returned to the pool when it ends. all lookups made through it
+    // see the same snapshot
+    Txn acquire()
+    {
+        MDB_txn* txn = nullptr;
+        {
+            std::lock_guard<std::mutex> lock{_mutex};
+            if (!_idle.empty())
+            {
+                txn = _idle.back();
+                _idle.pop_back();
+            }
+        }
+
+        if (txn)
+        {
+            int rc = mdb_txn_renew(txn);
+            if (rc != MDB_SUCCESS)
+            {
+                mdb_txn_abort(txn);
+                check(rc);
+            }
+        }
+        else
+        {
+            check(mdb_txn_begin(_env, nullptr, MDB_RDONLY, &txn));
+        }
+
+        Txn t;
+        t._env = _env;
+        t._txn = txn;
+        t._pool = this;
+        return t;
+    }
+
+private:
+    friend class Txn;
+
+    void release(MDB_txn* txn)
+    {
+        mdb_txn_reset(txn);
+        std::lock_guard<std::mutex> lock{_mutex};
+        _idle.push_back(txn);
+    }
+
+    MDB_env* _env;
+    std::mutex _mutex;
+    std::vector<MDB_txn*> _idle;
 };
 
+inline void Txn::release()
+{
+    _pool->release(_txn);
+    _txn = nullptr;
+    _pool = nullptr;
+}
+
+inline Txn::~Txn()
+{
+    if (_pool && _txn != nullptr)
+        release();
+    else if (_autocommit && _txn != nullptr)
+        commit();
+}
+
 // read-only view of a single value for a given key
 template <typename T>
 class ValueView
@@ -483,6 +691,13 @@ public:
         _txn.get(dbi, key, _val);
     }
 
+    // reads through an existing, e.g. pooled, read transaction and keeps it until destroyed
+    ValueView(Txn&& txn, MDB_dbi dbi, MDB_val* key)
+        : _txn{std::move(txn)}
+    {
+        _txn.get(dbi, key, _val);
+    }
+
     ValueView(ValueView& o)
         : _txn{o._txn}
         , _val{o._val}
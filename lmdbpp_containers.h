@@ -1,6 +1,7 @@
 #ifndef __lmdbpp_iterators
 #define __lmdbpp_iterators
 
+#include <span>
 #include "lmdbpp.h"
 
 namespace lmdbpp
@@ -11,7 +12,8 @@ struct IteratorSentinel
 };
 const IteratorSentinel _sentinel{};
 
-template <typename TData>
+// TDerived provides next(), called without a virtual dispatch so it can be inlined into loops
+template <typename TDerived, typename TData>
 class IteratorBase
 {
 public:
@@ -36,10 +38,10 @@ public:
         return &_data;
     }
 
-    IteratorBase& operator++()
+    TDerived& operator++()
     {
-        this->next();
-        return *this;
+        static_cast<TDerived*>(this)->next();
+        return static_cast<TDerived&>(*this);
     }
 
 protected:
@@ -47,8 +49,6 @@ protected:
     {
     }
 
-    virtual void next() = 0;
-
     TData _data;
     bool _end = false;
 };
@@ -67,19 +67,13 @@ template <typename TKey, typename TVal>
 class KeyValIteratable : public IteratableBase
 {
 public:
-    class Iterator : public IteratorBase<KeyVal<TKey, TVal>>
+    class Iterator : public IteratorBase<Iterator, KeyVal<TKey, TVal>>
     {
     protected:
-        void next() override
+        friend IteratorBase<Iterator, KeyVal<TKey, TVal>>;
+        void next()
         {
-            try
-            {
-                _c.get(this->_data, this->_data.key.data() == nullptr ? MDB_FIRST : MDB_NEXT);
-            }
-            catch (NotFoundError& e)
-            {
-                this->_end = true;
-            }
+            this->_end = !_c.try_get(this->_data, this->_data.key.data() == nullptr ? MDB_FIRST : MDB_NEXT).found();
         }
 
     private:
@@ -91,7 +85,7 @@ public:
         }
 
         Iterator(Iterator& o)
-            : IteratorBase<KeyVal<TKey, TVal>>(o)
+            : IteratorBase<Iterator, KeyVal<TKey, TVal>>(o)
             , _c{o._c}
         {
         }
@@ -99,6 +93,13 @@ public:
         Cursor _c;
     };
 
+    // iterates inside txn, e.g. a pooled one, which ends with the iteratable
+    KeyValIteratable(Txn&& txn, MDB_dbi dbi)
+        : _txn{std::move(txn)}
+        , _dbi(dbi)
+    {
+    }
+
     KeyValIteratable(MDB_env* env, MDB_dbi dbi)
         : _txn{env, MDB_RDONLY}
         , _dbi(dbi)
@@ -124,28 +125,26 @@ template <typename TKey>
 class KeyIteratable : public IteratableBase
 {
 public:
-    class Iterator : public IteratorBase<Val<TKey>>
+    class Iterator : public IteratorBase<Iterator, Val<TKey>>
     {
     protected:
-        void next() override
+        friend IteratorBase<Iterator, Val<TKey>>;
+        void next()
         {
-            try
+            Status status;
+            if (this->_data.data() == nullptr)
             {
-                if (this->_data.data() == nullptr)
-                {
-                    _c.get(this->_data, _unused_val, MDB_FIRST);
-                }
-                else
-                {
-                    if (_is_dup)
-                        _c.get(this->_data, _unused_val, MDB_LAST_DUP);
-                    _c.get(this->_data, _unused_val, MDB_NEXT);
-                }
+                status = _c.try_get(this->_data, _unused_val, MDB_FIRST);
             }
-            catch (NotFoundError& e)
+            else
             {
-                this->_end = true;
+                // MDB_NEXT_NODUP would do, if it didn't fail on non-DUPSORT dbis
+                if (_is_dup)
+                    status = _c.try_get(this->_data, _unused_val, MDB_LAST_DUP);
+                if (status.found())
+                    status = _c.try_get(this->_data, _unused_val, MDB_NEXT);
             }
+            this->_end = !status.found();
         }
 
     private:
@@ -157,7 +156,7 @@ public:
             next();
         }
         Iterator(Iterator& o)
-            : IteratorBase<Val<TKey>>(o)
+            : IteratorBase<Iterator, Val<TKey>>(o)
             , _is_dup(o._is_dup)
             , _c{o._c}
         {
@@ -167,6 +166,12 @@ public:
         bool _is_dup = false;
     };
 
+    KeyIteratable(Txn&& txn, MDB_dbi dbi)
+        : _txn{std::move(txn)}
+        , _dbi(dbi)
+    {
+    }
+
     KeyIteratable(MDB_env* env, MDB_dbi dbi)
         : _txn{env, MDB_RDONLY, true}
         , _dbi(dbi)
@@ -189,59 +194,106 @@ protected:
     MDB_dbi _dbi;
 };
 
-// pretty much for MDB_MULTIPLE + MDB_DUPFIXED values *only*
+// pretty much for MDB_MULTIPLE + MDB_DUPFIXED values *only*.
+// pages() yields the values a page at a time, as spans straight into the map, for loops that want to run over
+// them without going through the iterator per value
 template <typename TKey, typename TVal>
 class MultipleValueIteratable : public IteratableBase
 {
 public:
-    class Iterator : public IteratorBase<TVal>
+    class PageIterator : public IteratorBase<PageIterator, std::span<const TVal>>
     {
     protected:
-        void next() override
+        friend IteratorBase<PageIterator, std::span<const TVal>>;
+        void next()
         {
-            if (_kv.val.data() == nullptr || _kv.val.size() == 0)
+            Status status;
+            if (_kv.val.data() == nullptr)
             {
-                try
-                {
-                    if (_kv.val.data() == nullptr)
-                    {
-                        _c.get(_kv, MDB_SET);
-                        _c.get(_kv, MDB_GET_MULTIPLE);
-                    }
-                    else
-                    {
-                        _c.get(_kv, MDB_NEXT_MULTIPLE);
-                    }
-                }
-                catch (NotFoundError& e)
+                status = _c.try_get(_kv, MDB_SET);
+                if (status.found())
+                    status = _c.try_get(_kv, MDB_GET_MULTIPLE);
+            }
+            else
+            {
+                status = _c.try_get(_kv, MDB_NEXT_MULTIPLE);
+            }
+            this->_end = !status.found();
+            if (!this->_end)
+                this->_data = {_kv.val.data(), _kv.val.size() / sizeof(TVal)};
+        }
+
+    private:
+        friend class MultipleValueIteratable;
+        PageIterator(Txn& txn, MDB_dbi dbi, const Val<TKey>& key)
+            : _c{txn, dbi, true}
+            , _kv{key, {}}
+        {
+            next();
+        }
+
+        Cursor _c;
+        KeyVal<TKey, TVal> _kv{};
+    };
+
+    class Iterator : public IteratorBase<Iterator, TVal>
+    {
+    protected:
+        friend IteratorBase<Iterator, TVal>;
+        void next()
+        {
+            while (_page.empty())
+            {
+                if (!(_pages != _sentinel))
                 {
                     this->_end = true;
+                    return;
                 }
+                // pages stay mapped until the txn ends, so the cursor may move on
+                _page = *_pages;
+                ++_pages;
             }
-
-            this->_data = *_kv.val.data();
-            _kv.val.size(_kv.val.size() - sizeof(TVal));
-            _kv.val.data(_kv.val.data() + 1);
+            this->_data = _page.front();
+            _page = _page.subspan(1);
         }
 
     private:
         friend class MultipleValueIteratable;
         Iterator(Txn& txn, MDB_dbi dbi, const Val<TKey>& key)
-            : _kv{key, {}}
-            , _c{txn, dbi, true}
+            : _pages{txn, dbi, key}
         {
             next();
         }
-        Iterator(Iterator& o)
-            : IteratorBase<Val<TVal>>(o)
-            , _c{o._c}
+
+        PageIterator _pages;
+        std::span<const TVal> _page;
+    };
+
+    class Pages : public IteratableBase
+    {
+    public:
+        PageIterator begin()
         {
+            return PageIterator{_owner._txn, _owner._dbi, _owner._key};
         }
 
-        Cursor _c;
-        KeyVal<TKey, TVal> _kv{};
+    private:
+        friend class MultipleValueIteratable;
+        Pages(MultipleValueIteratable& owner)
+            : _owner(owner)
+        {
+        }
+
+        MultipleValueIteratable& _owner;
     };
 
+    MultipleValueIteratable(Txn&& txn, MDB_dbi dbi, const Val<TKey>& key)
+        : _txn{std::move(txn)}
+        , _dbi(dbi)
+        , _key{key}
+    {
+    }
+
     MultipleValueIteratable(MDB_env* env, MDB_dbi dbi, const Val<TKey>& key)
         : _txn{env, MDB_RDONLY, true}
         , _dbi(dbi)
@@ -261,6 +313,12 @@ public:
         return Iterator{_txn, _dbi, _key};
     }
 
+    // valid as long as this is
+    Pages pages()
+    {
+        return Pages{*this};
+    }
+
 protected:
     Txn _txn;
     MDB_dbi _dbi;
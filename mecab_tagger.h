@@ -1,7 +1,9 @@
 #ifndef __mecab_tagger_h
 #define __mecab_tagger_h
 
+#include <memory>
 #include <string>
+#include <string_view>
 #include <mecab.h>
 #include <unordered_set>
 #include "tagger.h"
@@ -9,43 +11,77 @@
 namespace tagging
 {
 
+// process-wide MeCab model, the dictionary is loaded once on first use.
+// taggers/lattices created from it share the dictionary and are cheap.
+class MecabModel
+{
+public:
+    struct Session
+    {
+        std::unique_ptr<MeCab::Tagger> tagger;
+        std::unique_ptr<MeCab::Lattice> lattice;
+    };
+
+    static MecabModel& instance()
+    {
+        static MecabModel model;
+        return model;
+    }
+
+    // tagger + lattice belonging to the calling thread
+    Session& thread_session()
+    {
+        thread_local Session session{std::unique_ptr<MeCab::Tagger>{_model->createTagger()},
+                                     std::unique_ptr<MeCab::Lattice>{_model->createLattice()}};
+        if (!session.tagger || !session.lattice) throw std::runtime_error{"couldn't create MeCab tagger"};
+        return session;
+    }
+
+private:
+    MecabModel()
+        : _model{MeCab::createModel("")}
+    {
+        if (!_model) throw std::runtime_error{"couldn't load MeCab model"};
+    }
+
+    std::unique_ptr<MeCab::Model> _model;
+};
+
+// uses the calling thread's MecabModel session, so only one MecabTagger per thread may be in use at a time
 class MecabTagger : public Tagger
 {
 public:
-    static const std::unordered_set<std::string> default_stopwords;
+    static const std::unordered_set<std::string_view> default_stopwords;
 
-    MecabTagger(char const *input, std::size_t size, const std::unordered_set<std::string>& stopwords = default_stopwords)
-        : input(input), tagger{0}, size(size), mc_node(nullptr), _stopwords(stopwords)
+    MecabTagger(char const *input, std::size_t size, const std::unordered_set<std::string_view>& stopwords = default_stopwords)
+        : session(MecabModel::instance().thread_session()), input(input), size(size), mc_node(nullptr), _stopwords(stopwords)
     {
-        tagger = MeCab::createTagger("");
-        if (!tagger) throw std::runtime_error{"couldn't create MeCab tagger"};
     }
 
+    // out_node only holds views into the input and MeCab's dictionary, nothing is copied
     bool next(Node &out_node)
     {
-        if (!mc_node || !(mc_node = mc_node->next) || mc_node->stat == MECAB_EOS_NODE)
+        while (true)
         {
-            if (!next_span(span)) return false;
+            if (mc_node) mc_node = mc_node->next;
 
-            mc_node = mecab_parse_to_node(span);
+            if (!mc_node || mc_node->stat == MECAB_EOS_NODE)
+            {
+                if (!next_span(span)) return false;
 
-            if (mc_node->stat == MECAB_BOS_NODE) mc_node = mc_node->next; //skip beginning of string node
-        }
+                mc_node = mecab_parse_to_node(span); // beginning of string node, skipped next iteration
+                continue;
+            }
 
-        out_node.location = mc_node->surface - input;
-        out_node.word = std::string{mc_node->surface, mc_node->length};
-        parse_mecab_feature(mc_node, out_node);
+            out_node.location = mc_node->surface - input;
+            out_node.word = std::string_view{mc_node->surface, mc_node->length};
+            out_node.feature = std::string_view{mc_node->feature};
 
-        if (_stopwords.find(out_node.base) == _stopwords.end())
-        {
-            return true;
+            if (_stopwords.find(out_node.base()) == _stopwords.end())
+            {
+                return true;
+            }
         }
-        return next(out_node);
-    }
-
-    ~MecabTagger()
-    {
-        if (tagger) delete tagger;
     }
 
 private:
@@ -62,58 +98,36 @@ private:
         std::size_t end;
     }; // indices into the input data
 
-    MeCab::Tagger *tagger;
+    MecabModel::Session &session;
     char const *input;
     std::size_t size;
     Span span;
+    std::size_t next_span_start = 0;
     const MeCab::Node *mc_node;
-    const std::unordered_set<std::string>& _stopwords;
+    const std::unordered_set<std::string_view>& _stopwords;
 
-    bool next_span(Span &s) const
+    bool next_span(Span &s)
     {
-        if (s.end >= size) // we're at the end
+        if (next_span_start >= size) // we're at the end
             return false;
 
-        s.start = s.end == 0 ? 0 : s.end + 1;
-        ++s.end;
-        for (; s.end < size && input[s.end] != '\n'; ++s.end)
+        s.start = next_span_start;
+        for (s.end = s.start; s.end < size && input[s.end] != '\n'; ++s.end)
             ;
+        next_span_start = s.end + 1;
 
         return true;
     }
 
     const MeCab::Node* mecab_parse_to_node(const Span& s) const
     {
-        return tagger->parseToNode(&input[span.start], span.length());
-    }
-
-    void parse_mecab_feature(const MeCab::Node *n, Node &out) const
-    {
-        int len = 0;
-        int i = 0;
-        out.feature = std::string{n->feature};
-        for (auto p = n->feature;; ++p)
-        {
-            if (*p == ',' || *p == '\0')
-            {
-                switch (i)
-                {
-                case 6:
-                    out.base = std::string{p - len + 1, (size_t)len - 1};
-                    break;
-                case 7:
-                    out.reading = std::string{p - len + 1, (size_t)len - 1};
-                    return;
-                }
-                len = 0;
-                ++i;
-            }
-            ++len;
-        }
+        session.lattice->set_sentence(&input[s.start], s.length());
+        if (!session.tagger->parse(session.lattice.get())) throw std::runtime_error{session.lattice->what()};
+        return session.lattice->bos_node();
     }
 };
 
-const std::unordered_set<std::string> MecabTagger::default_stopwords = { "。", "？", "?", "、" };
+const std::unordered_set<std::string_view> MecabTagger::default_stopwords = { "。", "？", "?", "、" };
 }
 
 #endif
@@ -2,26 +2,35 @@
 #define __mmap_h
 
 #include <cassert>
+#include <cerrno>
 #include <fcntl.h>
 #include <iostream>
+#include <string>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <system_error>
 #include <unistd.h>
 
 //cheapo wrapper around a read-only memory map
 class Mmap
 {
 public:
+    // throws if the file can't be mapped, which includes empty files
     Mmap(const std::string& file_path)
     {
+        fd = open(file_path.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            throw std::system_error{errno, std::generic_category(), "couldn't open " + file_path};
         struct stat st;
-        stat(file_path.c_str(), &st);
+        if (fstat(fd, &st) < 0)
+            fail("couldn't stat " + file_path);
         file_size = st.st_size;
-        fd = open(file_path.c_str(), O_RDONLY, 0);
-        assert(fd != 1);
+        if (file_size == 0)
+            fail("couldn't map " + file_path + ", it's empty", EINVAL);
         map = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
-        assert(map != MAP_FAILED);
+        if (map == MAP_FAILED)
+            fail("couldn't map " + file_path);
     }
 
     ~Mmap()
@@ -42,6 +51,13 @@ public:
     }
 
 private:
+    [[noreturn]] void fail(const std::string& what, int error = 0)
+    {
+        error = error ? error : errno;
+        close(fd);
+        throw std::system_error{error, std::generic_category(), what};
+    }
+
     void* map;
     int fd;
     std::size_t file_size;
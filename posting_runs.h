@@ -0,0 +1,269 @@
+#ifndef __posting_runs_h
+#define __posting_runs_h
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <queue>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "postings.h"
+
+namespace postings
+{
+
+// a document's postings grouped by term, for documents too big to hold all of them in memory. once they take up
+// more than the memory budget, the terms collected so far are written to a temporary file as a run sorted by
+// term and dropped from memory. for_each() then k-way merges the runs.
+// postings have to be added in order, a run only ever holds postings after those of the runs before it
+class PostingRuns
+{
+public:
+    // postings handed to for_each() at a time when merging
+    static constexpr std::size_t merge_batch = 64 * 1024;
+
+    // runs kept at most, more are merged into one. each holds a file open
+    static constexpr std::size_t max_runs = 64;
+
+    explicit PostingRuns(std::size_t memory_budget)
+        : _budget(memory_budget)
+    {
+    }
+
+    PostingRuns(const PostingRuns&) = delete;
+    PostingRuns& operator=(const PostingRuns&) = delete;
+
+    ~PostingRuns()
+    {
+        for (auto file : _runs) fclose(file);
+    }
+
+    void add(std::string_view term, const WordIdx& idx)
+    {
+        auto it = _terms.find(term);
+        if (it == _terms.end())
+        {
+            it = _terms.emplace(std::string{term}, std::vector<WordIdx>{}).first;
+            _bytes += term_overhead + term.size();
+        }
+
+        auto capacity = it->second.capacity();
+        it->second.push_back(idx);
+        _bytes += (it->second.capacity() - capacity) * sizeof(WordIdx);
+
+        if (_bytes > _budget)
+            spill();
+    }
+
+    std::size_t runs() const
+    {
+        return _runs.size();
+    }
+
+    // calls f(std::string_view term, std::span<const WordIdx> postings, bool first) for every term, in order of
+    // term if anything was spilled. a term's postings may come in several consecutive calls, first is set on the
+    // first of them. consumes the postings, call once
+    template <typename F>
+    void for_each(F&& f)
+    {
+        if (_runs.empty())
+        {
+            for (auto& [term, postings] : _terms) f(std::string_view{term}, std::span<const WordIdx>{postings}, true);
+            _terms.clear();
+            return;
+        }
+
+        if (!_terms.empty())
+            spill();
+        merge([](std::string_view, uint64_t) {}, f);
+    }
+
+private:
+    // roughly what a term costs besides its postings: map node, hash bucket, string and vector
+    static constexpr std::size_t term_overhead = 96;
+
+    struct TermHash
+    {
+        using is_transparent = void;
+
+        std::size_t operator()(std::string_view s) const
+        {
+            return std::hash<std::string_view>{}(s);
+        }
+    };
+
+    // reads a run back term by term. a term is stored as its size, the term, the number of postings and the postings
+    struct RunReader
+    {
+        FILE* file;
+        std::string term;
+        uint64_t left = 0;  // postings of term not read yet
+
+        bool next_term()
+        {
+            uint32_t size;
+            if (fread(&size, sizeof(size), 1, file) != 1)
+                return false;
+            term.resize(size);
+            if (fread(term.data(), 1, size, file) != size || fread(&left, sizeof(left), 1, file) != 1)
+                throw std::runtime_error{"couldn't read spilled postings"};
+            return true;
+        }
+
+        std::size_t read(WordIdx* out, std::size_t n)
+        {
+            n = std::min<uint64_t>(n, left);
+            if (fread(out, sizeof(WordIdx), n, file) != n)
+                throw std::runtime_error{"couldn't read spilled postings"};
+            left -= n;
+            return n;
+        }
+    };
+
+    // unlinked right away, so it's gone with the process however that ends
+    static FILE* temporary_file()
+    {
+        auto path = (std::filesystem::temp_directory_path() / "rei-postings-XXXXXX").string();
+        int fd = mkstemp(path.data());
+        if (fd < 0)
+            throw std::system_error{errno, std::generic_category(), "couldn't create " + path};
+        unlink(path.c_str());
+        FILE* file = fdopen(fd, "w+b");
+        if (!file)
+        {
+            close(fd);
+            throw std::system_error{errno, std::generic_category(), "fdopen"};
+        }
+        return file;
+    }
+
+    void spill()
+    {
+        std::vector<decltype(_terms)::value_type*> sorted;
+        sorted.reserve(_terms.size());
+        for (auto& entry : _terms) sorted.push_back(&entry);
+        std::sort(sorted.begin(), sorted.end(), [](auto a, auto b) { return a->first < b->first; });
+
+        FILE* file = temporary_file();
+        _runs.push_back(file);
+        for (auto entry : sorted)
+        {
+            auto& [term, postings] = *entry;
+            write_term(file, term, postings.size());
+            write_postings(file, postings);
+        }
+        if (fflush(file) != 0)
+            throw std::runtime_error{"couldn't spill postings, out of temporary space?"};
+
+        _terms = {};
+        _bytes = 0;
+
+        if (_runs.size() >= max_runs)
+            compact();
+    }
+
+    // merges all runs into one
+    void compact()
+    {
+        FILE* file = temporary_file();
+        try
+        {
+            merge([&](std::string_view term, uint64_t count) { write_term(file, term, count); },
+                  [&](std::string_view, std::span<const WordIdx> postings, bool) { write_postings(file, postings); });
+            if (fflush(file) != 0)
+                throw std::runtime_error{"couldn't spill postings, out of temporary space?"};
+        }
+        catch (...)
+        {
+            fclose(file);
+            throw;
+        }
+
+        for (auto run : _runs) fclose(run);
+        _runs = {file};
+    }
+
+    static void write_term(FILE* file, std::string_view term, uint64_t count)
+    {
+        uint32_t size = term.size();
+        if (fwrite(&size, sizeof(size), 1, file) != 1 || fwrite(term.data(), 1, size, file) != size ||
+            fwrite(&count, sizeof(count), 1, file) != 1)
+            throw std::runtime_error{"couldn't spill postings, out of temporary space?"};
+    }
+
+    static void write_postings(FILE* file, std::span<const WordIdx> postings)
+    {
+        if (fwrite(postings.data(), sizeof(WordIdx), postings.size(), file) != postings.size())
+            throw std::runtime_error{"couldn't spill postings, out of temporary space?"};
+    }
+
+    // calls begin(term, count) once per term, then f as for for_each() with its postings
+    template <typename B, typename F>
+    void merge(B&& begin, F&& f)
+    {
+        std::vector<RunReader> readers;
+        for (auto file : _runs)
+        {
+            rewind(file);
+            readers.push_back({file});
+        }
+
+        // smallest term on top, and for the same term the earliest run, whose postings come first
+        auto later = [&](std::size_t a, std::size_t b) {
+            int c = readers[a].term.compare(readers[b].term);
+            return c > 0 || (c == 0 && a > b);
+        };
+        std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(later)> heap{later};
+        for (std::size_t i = 0; i < readers.size(); ++i)
+        {
+            if (readers[i].next_term())
+                heap.push(i);
+        }
+
+        std::vector<WordIdx> batch(merge_batch);
+        std::vector<std::size_t> group;  // runs holding the current term, in order
+        std::string term;
+        while (!heap.empty())
+        {
+            term = readers[heap.top()].term;
+            group.clear();
+            uint64_t count = 0;
+            while (!heap.empty() && readers[heap.top()].term == term)
+            {
+                group.push_back(heap.top());
+                count += readers[heap.top()].left;
+                heap.pop();
+            }
+
+            begin(std::string_view{term}, count);
+            bool first = true;
+            for (auto i : group)
+            {
+                for (std::size_t n; (n = readers[i].read(batch.data(), batch.size())) > 0; first = false)
+                {
+                    f(std::string_view{term}, std::span<const WordIdx>{batch.data(), n}, first);
+                }
+                if (readers[i].next_term())
+                    heap.push(i);
+            }
+        }
+    }
+
+    const std::size_t _budget;
+    std::size_t _bytes = 0;
+    std::unordered_map<std::string, std::vector<WordIdx>, TermHash, std::equal_to<>> _terms;
+    std::vector<FILE*> _runs;
+};
+
+}  // namespace postings
+
+#endif
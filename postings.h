@@ -0,0 +1,542 @@
+#ifndef __postings_h
+#define __postings_h
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "lmdbpp.h"
+#include "lmdbpp_containers.h"
+
+namespace postings
+{
+
+// {doc id, word location} packed into one integer, ordered by doc, then location.
+// position is the word's ordinal among the indexed words of its document, for phrase/proximity matching.
+// pos is the word's part of speech there, a tagging::Pos
+struct WordIdx
+{
+    uint64_t n;
+    uint32_t position;
+    uint8_t pos;
+
+    WordIdx() = default;
+    WordIdx(uint32_t doc, uint32_t location, uint32_t position = 0, uint8_t pos = 0)
+        : n{(uint64_t)doc << 32 | location}
+        , position(position)
+        , pos(pos)
+    {
+    }
+
+    uint32_t doc() const
+    {
+        return n >> 32;
+    }
+
+    uint32_t location() const
+    {
+        return (uint32_t)n;
+    }
+};
+
+// per term totals, see LmdbFullText's word_stats dbi
+struct TermStats
+{
+    uint64_t occurrences;
+    uint64_t documents;
+    uint32_t pos_mask;  // bit per tagging::Pos the term was seen as. only ever grows, deleting documents keeps it
+};
+
+// a term's postings are stored as DUPSORT values of its key, each one a compressed block:
+//
+//   [0, 8)    last posting as big-endian integer. memcmp (LMDB's default dup order) thus sorts the blocks,
+//             and MDB_GET_BOTH_RANGE with a big-endian posting finds the only block that may contain it
+//   [8, 16)   first posting
+//   [16, 20)  first posting's position
+//   20        number of postings
+//   21..23    bit widths of the packed doc id, location and position deltas
+//   24        first posting's part of speech
+//   25        bit width of the packed parts of speech
+//   [26, ..)  doc id deltas, then location deltas and position deltas (both absolute when the doc changes)
+//             and parts of speech xor the first one's (so all zero bits for the usual single pos terms)
+//             of all but the first posting. each is bit-packed into four interleaved 32 bit lanes, value i
+//             lives in lane i % 4, so four values are unpacked in lockstep by the same shifts and masks
+//             (SIMD-BP128 style).
+namespace block
+{
+constexpr std::size_t max_postings = 128;
+constexpr std::size_t max_size = 511;  // LMDB's default max key size, which also applies to DUPSORT values
+constexpr std::size_t header_size = 26;
+
+inline void store_be64(uint8_t* out, uint64_t v)
+{
+    for (int i = 7; i >= 0; --i, v >>= 8) out[i] = (uint8_t)v;
+}
+
+inline uint64_t load_be64(const uint8_t* in)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v = v << 8 | in[i];
+    return v;
+}
+
+inline unsigned bit_width(uint32_t v)
+{
+    return v ? 32 - __builtin_clz(v) : 0;
+}
+
+// bytes needed for count values of the given bit width
+inline std::size_t packed_size(std::size_t count, unsigned bits)
+{
+    std::size_t slots = (count + 3) / 4;
+    return 16 * ((slots * bits + 31) / 32);
+}
+
+inline void pack(const uint32_t* in, std::size_t count, unsigned bits, uint8_t* out)
+{
+    uint32_t words[max_postings] = {};
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        std::size_t bit = (i / 4) * bits;
+        std::size_t w = 4 * (bit / 32) + i % 4;
+        unsigned shift = bit % 32;
+        words[w] |= in[i] << shift;
+        if (shift + bits > 32)
+            words[w + 4] |= in[i] >> (32 - shift);
+    }
+    std::memcpy(out, words, packed_size(count, bits));
+}
+
+// writes count values rounded up to a multiple of four into out
+inline void unpack(const uint8_t* in, std::size_t count, unsigned bits, uint32_t* out)
+{
+    std::size_t slots = (count + 3) / 4;
+    if (bits == 0)
+    {
+        std::fill(out, out + 4 * slots, 0);
+        return;
+    }
+
+    // one spare word per lane, so every value can be read as a 64 bit window without branching
+    uint32_t words[max_postings + 4] = {};
+    std::memcpy(words, in, packed_size(count, bits));
+
+    const uint64_t mask = (1ULL << bits) - 1;
+    for (std::size_t slot = 0; slot < slots; ++slot)
+    {
+        std::size_t bit = slot * bits;
+        const uint32_t* lo = &words[4 * (bit / 32)];
+        unsigned shift = bit % 32;
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            uint64_t window = (uint64_t)lo[lane + 4] << 32 | lo[lane];
+            out[4 * slot + lane] = (uint32_t)((window >> shift) & mask);
+        }
+    }
+}
+
+inline std::size_t count(const void* block)
+{
+    return ((const uint8_t*)block)[20];
+}
+
+inline WordIdx first(const void* block)
+{
+    WordIdx idx;
+    std::memcpy(&idx.n, (const uint8_t*)block + 8, sizeof(idx.n));
+    std::memcpy(&idx.position, (const uint8_t*)block + 16, sizeof(idx.position));
+    idx.pos = ((const uint8_t*)block)[24];
+    return idx;
+}
+
+// position and pos aren't stored for the last posting
+inline WordIdx last(const void* block)
+{
+    WordIdx idx;
+    idx.n = load_be64((const uint8_t*)block);
+    idx.position = 0;
+    idx.pos = 0;
+    return idx;
+}
+
+// encodes the first postings of a sorted run into out, returns how many went into the block
+inline std::size_t encode(const WordIdx* postings, std::size_t n, std::vector<uint8_t>& out)
+{
+    uint32_t doc_deltas[max_postings];
+    uint32_t location_deltas[max_postings];
+    uint32_t position_deltas[max_postings];
+    uint32_t pos_diffs[max_postings];
+    unsigned doc_bits, location_bits, position_bits, pos_bits;
+    std::size_t size;
+
+    n = std::min(n, max_postings);
+    while (true)
+    {
+        doc_bits = location_bits = position_bits = pos_bits = 0;
+        for (std::size_t i = 1; i < n; ++i)
+        {
+            uint32_t dd = postings[i].doc() - postings[i - 1].doc();
+            uint32_t ld = dd ? postings[i].location() : postings[i].location() - postings[i - 1].location();
+            uint32_t pd = dd ? postings[i].position : postings[i].position - postings[i - 1].position;
+            doc_deltas[i - 1] = dd;
+            location_deltas[i - 1] = ld;
+            position_deltas[i - 1] = pd;
+            pos_diffs[i - 1] = postings[i].pos ^ postings[0].pos;
+            doc_bits = std::max(doc_bits, bit_width(dd));
+            location_bits = std::max(location_bits, bit_width(ld));
+            position_bits = std::max(position_bits, bit_width(pd));
+            pos_bits = std::max(pos_bits, bit_width(pos_diffs[i - 1]));
+        }
+        size = header_size + packed_size(n - 1, doc_bits) + packed_size(n - 1, location_bits) +
+               packed_size(n - 1, position_bits) + packed_size(n - 1, pos_bits);
+        if (size <= max_size)
+            break;
+        n /= 2;
+    }
+
+    out.resize(size);
+    store_be64(out.data(), postings[n - 1].n);
+    std::memcpy(out.data() + 8, &postings[0].n, sizeof(postings[0].n));
+    std::memcpy(out.data() + 16, &postings[0].position, sizeof(postings[0].position));
+    out[20] = (uint8_t)n;
+    out[21] = (uint8_t)doc_bits;
+    out[22] = (uint8_t)location_bits;
+    out[23] = (uint8_t)position_bits;
+    out[24] = postings[0].pos;
+    out[25] = (uint8_t)pos_bits;
+    auto packed = out.data() + header_size;
+    pack(doc_deltas, n - 1, doc_bits, packed);
+    packed += packed_size(n - 1, doc_bits);
+    pack(location_deltas, n - 1, location_bits, packed);
+    packed += packed_size(n - 1, location_bits);
+    pack(position_deltas, n - 1, position_bits, packed);
+    packed += packed_size(n - 1, position_bits);
+    pack(pos_diffs, n - 1, pos_bits, packed);
+    return n;
+}
+
+// decodes a whole block into out, which needs room for max_postings entries. returns the number of postings
+inline std::size_t decode(const void* block, WordIdx* out)
+{
+    auto in = (const uint8_t*)block;
+    std::size_t n = in[20];
+    unsigned doc_bits = in[21];
+    unsigned location_bits = in[22];
+    unsigned position_bits = in[23];
+    unsigned pos_bits = in[25];
+
+    uint32_t doc_deltas[max_postings + 3];
+    uint32_t location_deltas[max_postings + 3];
+    uint32_t position_deltas[max_postings + 3];
+    uint32_t pos_diffs[max_postings + 3];
+    auto packed = in + header_size;
+    unpack(packed, n - 1, doc_bits, doc_deltas);
+    packed += packed_size(n - 1, doc_bits);
+    unpack(packed, n - 1, location_bits, location_deltas);
+    packed += packed_size(n - 1, location_bits);
+    unpack(packed, n - 1, position_bits, position_deltas);
+    packed += packed_size(n - 1, position_bits);
+    unpack(packed, n - 1, pos_bits, pos_diffs);
+
+    out[0] = first(block);
+    uint32_t doc = out[0].doc();
+    uint32_t location = out[0].location();
+    uint32_t position = out[0].position;
+    for (std::size_t i = 1; i < n; ++i)
+    {
+        doc += doc_deltas[i - 1];
+        location = doc_deltas[i - 1] ? location_deltas[i - 1] : location + location_deltas[i - 1];
+        position = doc_deltas[i - 1] ? position_deltas[i - 1] : position + position_deltas[i - 1];
+        out[i] = WordIdx{doc, location, position, (uint8_t)(out[0].pos ^ pos_diffs[i - 1])};
+    }
+    return n;
+}
+}  // namespace block
+
+// appends sorted postings to a term, all of them have to sort after the term's existing postings.
+// a partially filled last block is merged with the new postings, so adding many small documents
+// doesn't leave a trail of tiny blocks.
+inline void append(lmdbpp::Cursor& c, std::string_view term, std::span<const WordIdx> new_postings)
+{
+    std::vector<WordIdx> postings;
+    lmdbpp::Val<char> k{term};
+    lmdbpp::Val<> v;
+    if (c.try_get(k, v, MDB_SET).found() && c.try_get(k, v, MDB_LAST_DUP).found() &&
+        block::count(v.data()) < block::max_postings)
+    {
+        postings.resize(block::max_postings);
+        postings.resize(block::decode(v.data(), postings.data()));
+        c.del();
+    }
+
+    postings.insert(postings.end(), new_postings.begin(), new_postings.end());
+
+    std::vector<uint8_t> encoded;
+    for (std::size_t i = 0; i < postings.size();)
+    {
+        i += block::encode(&postings[i], postings.size() - i, encoded);
+        k = lmdbpp::Val<char>{term};
+        v = lmdbpp::Val<>{encoded.data(), encoded.size()};
+        c.put(k, v);
+    }
+}
+
+// removes all of doc's postings from term. only the blocks overlapping doc are read and rewritten,
+// found by seeking to the doc's first possible posting. returns the number of postings removed
+inline std::size_t remove(lmdbpp::Cursor& c, std::string_view term, uint32_t doc)
+{
+    uint8_t probe[8];
+    block::store_be64(probe, WordIdx{doc, 0}.n);
+
+    std::vector<std::vector<uint8_t>> blocks;
+    lmdbpp::Val<char> k{term};
+    lmdbpp::Val<> v{probe, sizeof(probe)};
+    for (auto status = c.try_get(k, v, MDB_GET_BOTH_RANGE);
+         status.found() && block::first(v.data()).doc() <= doc; status = c.try_get(k, v, MDB_NEXT_DUP))
+    {
+        auto data = (const uint8_t*)v.data();
+        blocks.emplace_back(data, data + v.size());
+    }
+
+    std::size_t removed = 0;
+    std::vector<WordIdx> kept;
+    std::vector<WordIdx> decoded(block::max_postings);
+    for (auto& b : blocks)
+    {
+        auto n = block::decode(b.data(), decoded.data());
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            if (decoded[i].doc() == doc)
+                ++removed;
+            else
+                kept.push_back(decoded[i]);
+        }
+
+        k = lmdbpp::Val<char>{term};
+        v = lmdbpp::Val<>{b.data(), b.size()};
+        c.get(k, v, MDB_GET_BOTH);
+        c.del();
+    }
+
+    std::vector<uint8_t> encoded;
+    for (std::size_t i = 0; i < kept.size();)
+    {
+        i += block::encode(&kept[i], kept.size() - i, encoded);
+        k = lmdbpp::Val<char>{term};
+        v = lmdbpp::Val<>{encoded.data(), encoded.size()};
+        c.put(k, v);
+    }
+    return removed;
+}
+
+// iterates over all postings of a term, decoding a block at a time.
+// blocks() yields each decoded block as a whole, for loops over many postings
+class PostingIteratable : public lmdbpp::IteratableBase
+{
+public:
+    // the span points into the iterator, and is overwritten by the next block
+    class BlockIterator : public lmdbpp::IteratorBase<BlockIterator, std::span<const WordIdx>>
+    {
+    protected:
+        friend lmdbpp::IteratorBase<BlockIterator, std::span<const WordIdx>>;
+        void next()
+        {
+            if (!_c.try_get(_kv, _kv.val.data() == nullptr ? MDB_SET : MDB_NEXT_DUP).found())
+            {
+                this->_end = true;
+                return;
+            }
+            this->_data = {_block, block::decode(_kv.val.data(), _block)};
+        }
+
+    private:
+        friend class PostingIteratable;
+        BlockIterator(lmdbpp::Txn& txn, MDB_dbi dbi, const lmdbpp::Val<char>& key)
+            : _c{txn, dbi, true}
+            , _kv{key, {}}
+        {
+            next();
+        }
+
+        lmdbpp::Cursor _c;
+        lmdbpp::KeyVal<char, void> _kv;
+        WordIdx _block[block::max_postings];
+    };
+
+    class Iterator : public lmdbpp::IteratorBase<Iterator, WordIdx>
+    {
+    protected:
+        friend lmdbpp::IteratorBase<Iterator, WordIdx>;
+        void next()
+        {
+            if (_pos == (*_blocks).size())
+            {
+                ++_blocks;
+                _pos = 0;
+            }
+            if (!(_blocks != lmdbpp::_sentinel))
+            {
+                this->_end = true;
+                return;
+            }
+            this->_data = (*_blocks)[_pos++];
+        }
+
+    private:
+        friend class PostingIteratable;
+        Iterator(lmdbpp::Txn& txn, MDB_dbi dbi, const lmdbpp::Val<char>& key)
+            : _blocks{txn, dbi, key}
+        {
+            if (_blocks != lmdbpp::_sentinel)
+                this->_data = (*_blocks)[_pos++];
+            else
+                this->_end = true;
+        }
+
+        BlockIterator _blocks;
+        std::size_t _pos = 0;
+    };
+
+    class Blocks : public lmdbpp::IteratableBase
+    {
+    public:
+        BlockIterator begin()
+        {
+            return BlockIterator{_owner._txn, _owner._dbi, lmdbpp::Val<char>{_owner._term}};
+        }
+
+    private:
+        friend class PostingIteratable;
+        Blocks(PostingIteratable& owner)
+            : _owner(owner)
+        {
+        }
+
+        PostingIteratable& _owner;
+    };
+
+    PostingIteratable(lmdbpp::Txn&& txn, MDB_dbi dbi, std::string_view term)
+        : _txn{std::move(txn)}
+        , _dbi(dbi)
+        , _term{term}
+    {
+    }
+
+    Iterator begin()
+    {
+        return Iterator{_txn, _dbi, lmdbpp::Val<char>{_term}};
+    }
+
+    // valid as long as this is
+    Blocks blocks()
+    {
+        return Blocks{*this};
+    }
+
+protected:
+    lmdbpp::Txn _txn;
+    MDB_dbi _dbi;
+    std::string _term;
+};
+
+// cursor over one term's postings inside an existing transaction.
+// seek() skips ahead by galloping inside the current block, and via MDB_GET_BOTH_RANGE on the
+// blocks' big-endian last postings once the target lies beyond it, so skipped blocks are never decoded.
+class PostingCursor
+{
+public:
+    PostingCursor(MDB_txn* txn, MDB_dbi dbi, std::string_view term)
+        : _c{txn, dbi, true}
+        , _term{term}
+    {
+        load_block(MDB_SET);
+    }
+
+    PostingCursor(const PostingCursor&) = delete;
+    PostingCursor& operator=(const PostingCursor&) = delete;
+
+    bool valid() const
+    {
+        return _pos < _count;
+    }
+
+    WordIdx current() const
+    {
+        return _block[_pos];
+    }
+
+    void next()
+    {
+        if (++_pos == _count)
+            load_block(MDB_NEXT_DUP);
+    }
+
+    // the current posting and the rest of its block, empty once done
+    std::span<const WordIdx> block() const
+    {
+        return {_block + _pos, _count - _pos};
+    }
+
+    // moves n postings ahead within block(), onto the next block if that's all of them
+    void advance(std::size_t n)
+    {
+        _pos += n;
+        if (_pos == _count)
+            load_block(MDB_NEXT_DUP);
+    }
+
+    // moves to the first posting >= target, never backwards
+    void seek(WordIdx target)
+    {
+        if (!valid() || target.n <= current().n)
+            return;
+
+        if (target.n > _block[_count - 1].n)
+        {
+            uint8_t probe[8];
+            block::store_be64(probe, target.n);
+            lmdbpp::Val<> v{probe, sizeof(probe)};
+            load_block(MDB_GET_BOTH_RANGE, v);
+            if (!valid())
+                return;
+        }
+
+        std::size_t lo = _pos;
+        std::size_t step = 1;
+        while (lo + step < _count && _block[lo + step].n < target.n)
+        {
+            lo += step;
+            step *= 2;
+        }
+        auto hi = std::min(lo + step + 1, _count);
+        _pos = std::lower_bound(&_block[lo], &_block[hi], target,
+                                [](const WordIdx& a, const WordIdx& b) { return a.n < b.n; }) -
+               _block;
+    }
+
+private:
+    void load_block(MDB_cursor_op op, lmdbpp::Val<> v = {})
+    {
+        lmdbpp::Val<char> k{_term};
+        if (!_c.try_get(k, v, op).found())
+        {
+            _pos = _count = 0;
+            return;
+        }
+        _count = block::decode(v.data(), _block);
+        _pos = 0;
+    }
+
+    lmdbpp::Cursor _c;
+    std::string _term;
+    WordIdx _block[block::max_postings];
+    std::size_t _count = 0;
+    std::size_t _pos = 0;
+};
+
+}  // namespace postings
+
+#endif
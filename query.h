@@ -0,0 +1,1060 @@
+#ifndef __query_h
+#define __query_h
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "lmdbpp.h"
+#include "lmdbpp_containers.h"
+#include "mecab_tagger.h"
+#include "postings.h"
+
+namespace query
+{
+
+// the dbis a query reads from
+struct Dbis
+{
+    MDB_dbi word_idx;
+    MDB_dbi word_stats;
+    MDB_dbi document_info;
+    MDB_dbi document_length;
+    MDB_dbi meta;
+};
+
+// iterates matching document ids in ascending order
+class DocIterator
+{
+public:
+    virtual ~DocIterator()
+    {
+    }
+
+    virtual bool valid() const = 0;
+    virtual uint32_t doc() const = 0;
+    virtual void next() = 0;
+
+    // moves to the first document >= doc, never backwards
+    virtual void seek(uint32_t doc) = 0;
+
+    // upper bound of matching documents, used to drive intersections from the rarest side
+    virtual uint64_t cost() const = 0;
+};
+
+// a match inside the current document, as first and last word position
+struct Span
+{
+    uint32_t start;
+    uint32_t end;
+};
+
+// document iterator that also knows where in the current document it matched
+class SpanIterator : public DocIterator
+{
+public:
+    // sorted by start
+    virtual const std::vector<Span>& spans() = 0;
+};
+
+// leapfrogs until all iterators are on the same document, false once one of them runs out.
+// iterators[0] proposes the candidates, so it should be the rarest
+template <typename Iterators>
+bool leapfrog(Iterators& iterators)
+{
+    if (!iterators[0]->valid())
+        return false;
+
+    uint32_t target = iterators[0]->doc();
+    std::size_t agreed = 1;
+    for (std::size_t i = 1; agreed < iterators.size(); i = (i + 1) % iterators.size())
+    {
+        auto& it = iterators[i];
+        it->seek(target);
+        if (!it->valid())
+            return false;
+        if (it->doc() == target)
+        {
+            ++agreed;
+        }
+        else
+        {
+            target = it->doc();
+            agreed = 1;
+        }
+    }
+    return true;
+}
+
+// a term's documents, optionally only those where it's used as a given part of speech.
+// postings of other parts of speech are skipped while scanning
+class TermIterator : public SpanIterator
+{
+public:
+    TermIterator(lmdbpp::Txn& txn, const Dbis& dbis, std::string_view term, std::optional<tagging::Pos> pos = {})
+        : _c{txn, dbis.word_idx, term}
+        , _pos(pos)
+    {
+        lmdbpp::KeyVal<char, postings::TermStats> kv{{term}, {}};
+        if (txn.try_get(dbis.word_stats, kv).found())
+        {
+            postings::TermStats stats;
+            std::memcpy(&stats, kv.val.data(), sizeof(stats));
+            _cost = stats.documents;
+
+            // never seen as pos, don't bother scanning
+            if (_pos && !(stats.pos_mask & 1u << (uint8_t)*_pos))
+                return;
+        }
+        sync();
+    }
+
+    bool valid() const override
+    {
+        return _valid;
+    }
+
+    uint32_t doc() const override
+    {
+        return _doc;
+    }
+
+    void next() override
+    {
+        _c.seek(postings::WordIdx{_doc + 1, 0});
+        sync();
+    }
+
+    void seek(uint32_t doc) override
+    {
+        if (_valid && doc > _doc)
+        {
+            _c.seek(postings::WordIdx{doc, 0});
+            sync();
+        }
+    }
+
+    uint64_t cost() const override
+    {
+        return _cost;
+    }
+
+    // positions of the term in the current document, its postings are only read when asked for
+    const std::vector<Span>& spans() override
+    {
+        if (!_collected)
+        {
+            _spans.clear();
+            while (_c.valid())
+            {
+                auto block = _c.block();
+                std::size_t i = 0;
+                for (; i < block.size() && block[i].doc() == _doc; ++i)
+                {
+                    if (matches(block[i]))
+                        _spans.push_back({block[i].position, block[i].position});
+                }
+                _c.advance(i);
+                if (i < block.size())
+                    break;
+            }
+            _collected = true;
+        }
+        return _spans;
+    }
+
+private:
+    bool matches(const postings::WordIdx& idx) const
+    {
+        return !_pos || idx.pos == (uint8_t)*_pos;
+    }
+
+    void sync()
+    {
+        while (_c.valid() && !matches(_c.current())) _c.next();
+        _valid = _c.valid();
+        if (_valid)
+            _doc = _c.current().doc();
+        _collected = false;
+    }
+
+    postings::PostingCursor _c;
+    std::optional<tagging::Pos> _pos;
+    bool _valid = false;
+    uint32_t _doc = 0;
+    uint64_t _cost = 0;
+    bool _collected = false;
+    std::vector<Span> _spans;
+};
+
+// union of many iterators, e.g. the terms a wildcard expanded to. a min heap on the current document
+// keeps next() and seek() logarithmic in the number of children instead of touching all of them
+class UnionIterator : public SpanIterator
+{
+public:
+    UnionIterator(std::vector<std::unique_ptr<SpanIterator>> children)
+        : _children(std::move(children))
+    {
+        for (auto& c : _children)
+        {
+            _cost += c->cost();
+            if (c->valid())
+                _heap.push_back(c.get());
+        }
+        std::make_heap(_heap.begin(), _heap.end(), later);
+    }
+
+    bool valid() const override
+    {
+        return !_heap.empty();
+    }
+
+    uint32_t doc() const override
+    {
+        return _heap.front()->doc();
+    }
+
+    void next() override
+    {
+        advance(doc() + 1);
+    }
+
+    void seek(uint32_t doc) override
+    {
+        advance(doc);
+    }
+
+    uint64_t cost() const override
+    {
+        return _cost;
+    }
+
+    // spans of all children on the current document
+    const std::vector<Span>& spans() override
+    {
+        _spans.clear();
+        for (auto c : _heap)
+        {
+            if (c->doc() == doc())
+                _spans.insert(_spans.end(), c->spans().begin(), c->spans().end());
+        }
+        std::sort(_spans.begin(), _spans.end(), [](const Span& a, const Span& b) { return a.start < b.start; });
+        return _spans;
+    }
+
+private:
+    static bool later(SpanIterator* a, SpanIterator* b)
+    {
+        return a->doc() > b->doc();
+    }
+
+    void advance(uint32_t target)
+    {
+        while (!_heap.empty() && _heap.front()->doc() < target)
+        {
+            std::pop_heap(_heap.begin(), _heap.end(), later);
+            auto c = _heap.back();
+            c->seek(target);
+            if (c->valid())
+                std::push_heap(_heap.begin(), _heap.end(), later);
+            else
+                _heap.pop_back();
+        }
+    }
+
+    std::vector<std::unique_ptr<SpanIterator>> _children;
+    std::vector<SpanIterator*> _heap;
+    uint64_t _cost = 0;
+    std::vector<Span> _spans;
+};
+
+// documents where the terms appear at consecutive positions. a positional merge join over the terms'
+// postings of each document all of them occur in
+class PhraseIterator : public SpanIterator
+{
+public:
+    PhraseIterator(std::vector<std::unique_ptr<SpanIterator>> terms)
+        : _terms(std::move(terms))
+    {
+        for (auto& t : _terms) _by_cost.push_back(t.get());
+        std::sort(_by_cost.begin(), _by_cost.end(), [](auto a, auto b) { return a->cost() < b->cost(); });
+        find();
+    }
+
+    bool valid() const override
+    {
+        return _valid;
+    }
+
+    uint32_t doc() const override
+    {
+        return _by_cost[0]->doc();
+    }
+
+    void next() override
+    {
+        _by_cost[0]->next();
+        find();
+    }
+
+    void seek(uint32_t doc) override
+    {
+        _by_cost[0]->seek(doc);
+        find();
+    }
+
+    uint64_t cost() const override
+    {
+        return _by_cost[0]->cost();
+    }
+
+    const std::vector<Span>& spans() override
+    {
+        return _spans;
+    }
+
+private:
+    void find()
+    {
+        while ((_valid = leapfrog(_by_cost)))
+        {
+            match();
+            if (!_spans.empty())
+                return;
+            _by_cost[0]->next();
+        }
+    }
+
+    void match()
+    {
+        _spans.clear();
+        std::vector<std::size_t> idx(_terms.size(), 0);
+        for (auto& first : _terms[0]->spans())
+        {
+            bool matched = true;
+            for (std::size_t i = 1; i < _terms.size() && matched; ++i)
+            {
+                auto& spans = _terms[i]->spans();
+                uint32_t want = first.start + i;
+                while (idx[i] < spans.size() && spans[idx[i]].start < want) ++idx[i];
+                if (idx[i] == spans.size())
+                    return;
+                matched = spans[idx[i]].start == want;
+            }
+            if (matched)
+                _spans.push_back({first.start, first.start + (uint32_t)_terms.size() - 1});
+        }
+    }
+
+    std::vector<std::unique_ptr<SpanIterator>> _terms;
+    std::vector<SpanIterator*> _by_cost;
+    bool _valid = false;
+    std::vector<Span> _spans;
+};
+
+// documents where a and b match at most slop words apart, in either order
+class NearIterator : public SpanIterator
+{
+public:
+    NearIterator(std::unique_ptr<SpanIterator> a, std::unique_ptr<SpanIterator> b, uint32_t slop)
+        : _slop(slop)
+    {
+        _both.push_back(std::move(a));
+        _both.push_back(std::move(b));
+        if (_both[1]->cost() < _both[0]->cost())
+            std::swap(_both[0], _both[1]);
+        find();
+    }
+
+    bool valid() const override
+    {
+        return _valid;
+    }
+
+    uint32_t doc() const override
+    {
+        return _both[0]->doc();
+    }
+
+    void next() override
+    {
+        _both[0]->next();
+        find();
+    }
+
+    void seek(uint32_t doc) override
+    {
+        _both[0]->seek(doc);
+        find();
+    }
+
+    uint64_t cost() const override
+    {
+        return _both[0]->cost();
+    }
+
+    const std::vector<Span>& spans() override
+    {
+        return _spans;
+    }
+
+private:
+    void find()
+    {
+        while ((_valid = leapfrog(_both)))
+        {
+            match();
+            if (!_spans.empty())
+                return;
+            _both[0]->next();
+        }
+    }
+
+    // sliding window over b's spans, both lists are sorted by start
+    void match()
+    {
+        _spans.clear();
+        auto& as = _both[0]->spans();
+        auto& bs = _both[1]->spans();
+
+        uint32_t longest_b = 0;
+        for (auto& b : bs) longest_b = std::max(longest_b, b.end - b.start);
+
+        std::size_t lo = 0;
+        for (auto& a : as)
+        {
+            while (lo < bs.size() && (uint64_t)bs[lo].start + longest_b + _slop < a.start) ++lo;
+            for (auto i = lo; i < bs.size() && bs[i].start <= (uint64_t)a.end + _slop; ++i)
+            {
+                auto& b = bs[i];
+                uint32_t gap = b.start > a.end ? b.start - a.end : a.start > b.end ? a.start - b.end : 0;
+                if (gap <= _slop)
+                    _spans.push_back({std::min(a.start, b.start), std::max(a.end, b.end)});
+            }
+        }
+
+        std::sort(_spans.begin(), _spans.end(),
+                  [](const Span& x, const Span& y) { return x.start < y.start || (x.start == y.start && x.end < y.end); });
+        _spans.erase(std::unique(_spans.begin(), _spans.end(),
+                                 [](const Span& x, const Span& y) { return x.start == y.start && x.end == y.end; }),
+                     _spans.end());
+    }
+
+    std::vector<std::unique_ptr<SpanIterator>> _both;
+    uint32_t _slop;
+    bool _valid = false;
+    std::vector<Span> _spans;
+};
+
+// every document, for queries that only exclude
+class AllDocsIterator : public DocIterator
+{
+public:
+    AllDocsIterator(lmdbpp::Txn& txn, const Dbis& dbis)
+        : _c{txn, dbis.document_info, true}
+    {
+        move(MDB_FIRST, {});
+
+        MDB_stat stat;
+        lmdbpp::check(mdb_stat(txn, dbis.document_info, &stat));
+        _cost = stat.ms_entries;
+    }
+
+    bool valid() const override
+    {
+        return _valid;
+    }
+
+    uint32_t doc() const override
+    {
+        return _doc;
+    }
+
+    void next() override
+    {
+        move(MDB_NEXT, {});
+    }
+
+    void seek(uint32_t doc) override
+    {
+        if (_valid && doc > _doc)
+            move(MDB_SET_RANGE, {&doc});
+    }
+
+    uint64_t cost() const override
+    {
+        return _cost;
+    }
+
+private:
+    void move(MDB_cursor_op op, lmdbpp::Val<uint32_t> k)
+    {
+        lmdbpp::Val<> unused_val;
+        _valid = _c.try_get(k, unused_val, op).found();
+        if (_valid)
+            _doc = *k.data();
+    }
+
+    lmdbpp::Cursor _c;
+    bool _valid = false;
+    uint32_t _doc = 0;
+    uint64_t _cost = 0;
+};
+
+// leapfrog intersection, the rarest child proposes candidates and the others seek to them
+class AndIterator : public DocIterator
+{
+public:
+    AndIterator(std::vector<std::unique_ptr<DocIterator>> children)
+        : _children(std::move(children))
+    {
+        std::sort(_children.begin(), _children.end(), [](auto& a, auto& b) { return a->cost() < b->cost(); });
+        align();
+    }
+
+    bool valid() const override
+    {
+        return _valid;
+    }
+
+    uint32_t doc() const override
+    {
+        return _children[0]->doc();
+    }
+
+    void next() override
+    {
+        _children[0]->next();
+        align();
+    }
+
+    void seek(uint32_t doc) override
+    {
+        _children[0]->seek(doc);
+        align();
+    }
+
+    uint64_t cost() const override
+    {
+        return _children[0]->cost();
+    }
+
+private:
+    void align()
+    {
+        _valid = leapfrog(_children);
+    }
+
+    std::vector<std::unique_ptr<DocIterator>> _children;
+    bool _valid = false;
+};
+
+class OrIterator : public DocIterator
+{
+public:
+    OrIterator(std::vector<std::unique_ptr<DocIterator>> children)
+        : _children(std::move(children))
+    {
+        update();
+    }
+
+    bool valid() const override
+    {
+        return _valid;
+    }
+
+    uint32_t doc() const override
+    {
+        return _doc;
+    }
+
+    void next() override
+    {
+        for (auto& c : _children)
+        {
+            if (c->valid() && c->doc() == _doc)
+                c->next();
+        }
+        update();
+    }
+
+    void seek(uint32_t doc) override
+    {
+        for (auto& c : _children) c->seek(doc);
+        update();
+    }
+
+    uint64_t cost() const override
+    {
+        uint64_t sum = 0;
+        for (auto& c : _children) sum += c->cost();
+        return sum;
+    }
+
+private:
+    void update()
+    {
+        _valid = false;
+        for (auto& c : _children)
+        {
+            if (c->valid() && (!_valid || c->doc() < _doc))
+            {
+                _doc = c->doc();
+                _valid = true;
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<DocIterator>> _children;
+    bool _valid = false;
+    uint32_t _doc = 0;
+};
+
+// documents of include that aren't in exclude
+class AndNotIterator : public DocIterator
+{
+public:
+    AndNotIterator(std::unique_ptr<DocIterator> include, std::unique_ptr<DocIterator> exclude)
+        : _include(std::move(include))
+        , _exclude(std::move(exclude))
+    {
+        skip_excluded();
+    }
+
+    bool valid() const override
+    {
+        return _include->valid();
+    }
+
+    uint32_t doc() const override
+    {
+        return _include->doc();
+    }
+
+    void next() override
+    {
+        _include->next();
+        skip_excluded();
+    }
+
+    void seek(uint32_t doc) override
+    {
+        _include->seek(doc);
+        skip_excluded();
+    }
+
+    uint64_t cost() const override
+    {
+        return _include->cost();
+    }
+
+private:
+    void skip_excluded()
+    {
+        while (_include->valid())
+        {
+            _exclude->seek(_include->doc());
+            if (!_exclude->valid() || _exclude->doc() != _include->doc())
+                return;
+            _include->next();
+        }
+    }
+
+    std::unique_ptr<DocIterator> _include;
+    std::unique_ptr<DocIterator> _exclude;
+};
+
+struct Expr
+{
+    enum Type
+    {
+        Term,
+        Phrase,
+        Near,
+        And,
+        Or,
+        Not
+    };
+
+    Type type;
+    std::string term;  // word, or the text of a phrase
+    std::vector<Expr> children;
+    uint32_t slop = 0;                // for Near
+    std::optional<tagging::Pos> pos;  // for Term, only match the word used as this part of speech
+};
+
+// or      := and ("OR" and)*
+// and     := not (["AND"] not)*
+// not     := "NOT" not | near
+// near    := primary ("NEAR/" slop primary)*
+// primary := "(" or ")" | '"' phrase '"' | term ["@" pos]
+class Parser
+{
+public:
+    Parser(const std::string& expression)
+    {
+        auto is_space = [](char ch) { return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r'; };
+        for (std::size_t i = 0; i < expression.size();)
+        {
+            char ch = expression[i];
+            std::size_t end = i + 1;
+            if (is_space(ch))
+            {
+                ++i;
+                continue;
+            }
+            else if (ch == '"')
+            {
+                end = expression.find('"', i + 1);
+                if (end == std::string::npos)
+                    throw std::runtime_error{"unterminated phrase in query"};
+                ++end;
+            }
+            else if (ch != '(' && ch != ')')
+            {
+                for (end = i; end < expression.size(); ++end)
+                {
+                    ch = expression[end];
+                    if (is_space(ch) || ch == '(' || ch == ')' || ch == '"')
+                        break;
+                }
+            }
+            _tokens.push_back(expression.substr(i, end - i));
+            i = end;
+        }
+    }
+
+    Expr parse()
+    {
+        if (_tokens.empty())
+            throw std::runtime_error{"empty query"};
+        auto e = parse_or();
+        if (_pos != _tokens.size())
+            throw std::runtime_error{"unexpected '" + _tokens[_pos] + "' in query"};
+        return e;
+    }
+
+private:
+    Expr parse_or()
+    {
+        Expr e{Expr::Or, {}, {}};
+        e.children.push_back(parse_and());
+        while (accept("OR")) e.children.push_back(parse_and());
+        return e.children.size() == 1 ? std::move(e.children[0]) : std::move(e);
+    }
+
+    Expr parse_and()
+    {
+        Expr e{Expr::And, {}, {}};
+        e.children.push_back(parse_not());
+        while (_pos < _tokens.size() && _tokens[_pos] != "OR" && _tokens[_pos] != ")")
+        {
+            accept("AND");
+            e.children.push_back(parse_not());
+        }
+        return e.children.size() == 1 ? std::move(e.children[0]) : std::move(e);
+    }
+
+    Expr parse_not()
+    {
+        if (accept("NOT"))
+            return Expr{Expr::Not, {}, {parse_not()}};
+        return parse_near();
+    }
+
+    Expr parse_near()
+    {
+        auto e = parse_primary();
+        while (_pos < _tokens.size() && _tokens[_pos].compare(0, 5, "NEAR/") == 0)
+        {
+            uint32_t slop;
+            try
+            {
+                slop = std::stoul(_tokens[_pos].substr(5));
+            }
+            catch (std::logic_error& ex)
+            {
+                throw std::runtime_error{"invalid '" + _tokens[_pos] + "' in query"};
+            }
+            ++_pos;
+            e = Expr{Expr::Near, {}, {std::move(e), parse_primary()}, slop};
+        }
+        return e;
+    }
+
+    Expr parse_primary()
+    {
+        if (_pos == _tokens.size())
+            throw std::runtime_error{"unexpected end of query"};
+        if (accept("("))
+        {
+            auto e = parse_or();
+            if (!accept(")"))
+                throw std::runtime_error{"missing ')' in query"};
+            return e;
+        }
+        const auto& t = _tokens[_pos];
+        if (t == ")" || t == "AND" || t == "OR" || t.compare(0, 5, "NEAR/") == 0)
+            throw std::runtime_error{"unexpected '" + t + "' in query"};
+        ++_pos;
+        if (t[0] == '"')
+            return Expr{Expr::Phrase, t.substr(1, t.size() - 2), {}};
+
+        auto at = t.find('@');
+        if (at == std::string::npos)
+            return Expr{Expr::Term, t, {}};
+        auto pos = tagging::pos_from_name(std::string_view{t}.substr(at + 1));
+        if (at == 0 || !pos)
+            throw std::runtime_error{"invalid part of speech filter '" + t + "' in query"};
+        Expr e{Expr::Term, t.substr(0, at), {}};
+        e.pos = pos;
+        return e;
+    }
+
+    bool accept(const char* token)
+    {
+        if (_pos < _tokens.size() && _tokens[_pos] == token)
+        {
+            ++_pos;
+            return true;
+        }
+        return false;
+    }
+
+    std::vector<std::string> _tokens;
+    std::size_t _pos = 0;
+};
+
+inline bool is_pattern(std::string_view term)
+{
+    return term.find_first_of("*?") != std::string_view::npos;
+}
+
+// '*' matches any number of characters and '?' exactly one, characters being utf-8 sequences
+inline bool glob_match(std::string_view pattern, std::string_view text)
+{
+    auto next_char = [](std::string_view s, std::size_t i) {
+        for (++i; i < s.size() && ((unsigned char)s[i] & 0xc0) == 0x80; ++i)
+            ;
+        return i;
+    };
+
+    std::size_t p = 0, t = 0;
+    std::size_t star = std::string_view::npos, star_t = 0;
+    while (t < text.size())
+    {
+        if (p < pattern.size() && pattern[p] == '*')
+        {
+            star = ++p;
+            star_t = t;
+        }
+        else if (p < pattern.size() && pattern[p] == '?')
+        {
+            ++p;
+            t = next_char(text, t);
+        }
+        else if (p < pattern.size() && pattern[p] == text[t])
+        {
+            ++p;
+            ++t;
+        }
+        else if (star != std::string_view::npos)
+        {
+            // let the last '*' swallow one more character
+            p = star;
+            t = star_t = next_char(text, star_t);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') ++p;
+    return p == pattern.size();
+}
+
+// calls f(term) for every indexed term matching a wildcard pattern, in key order. the literal prefix before the
+// first wildcard is range scanned with MDB_SET_RANGE, so "食べ*" only visits terms starting with 食べ.
+// patterns starting with a wildcard scan every term, LMDB rejects the empty key
+template <typename F>
+void expand(lmdbpp::Txn& txn, MDB_dbi word_stats, std::string_view pattern, F&& f)
+{
+    auto prefix = pattern.substr(0, pattern.find_first_of("*?"));
+    lmdbpp::Cursor c{txn, word_stats, true};
+    lmdbpp::Val<char> k{prefix};
+    lmdbpp::Val<> v;
+    auto first = prefix.empty() ? MDB_FIRST : MDB_SET_RANGE;
+    for (auto status = c.try_get(k, v, first); status.found(); status = c.try_get(k, v, MDB_NEXT))
+    {
+        auto term = lmdbpp::val_to_string_view(k);
+        if (term.compare(0, prefix.size(), prefix) != 0)
+            break;
+        if (glob_match(pattern, term))
+            f(term);
+    }
+}
+
+// base forms of a phrase's words, tokenized the same way documents are
+inline std::vector<std::string> phrase_terms(const std::string& text)
+{
+    std::vector<std::string> terms;
+    tagging::MecabTagger tagger{text.data(), text.size()};
+    for (tagging::Node n; tagger.next(n);)
+    {
+        terms.emplace_back(n.base());
+    }
+    return terms;
+}
+
+inline std::unique_ptr<SpanIterator> compile_spans(const Expr& e, lmdbpp::Txn& txn, const Dbis& dbis)
+{
+    switch (e.type)
+    {
+        case Expr::Term:
+        {
+            if (!is_pattern(e.term))
+                return std::make_unique<TermIterator>(txn, dbis, e.term, e.pos);
+
+            std::vector<std::unique_ptr<SpanIterator>> terms;
+            expand(txn, dbis.word_stats, e.term,
+                   [&](std::string_view t) { terms.push_back(std::make_unique<TermIterator>(txn, dbis, t, e.pos)); });
+            return std::make_unique<UnionIterator>(std::move(terms));
+        }
+
+        case Expr::Phrase:
+        {
+            auto terms = phrase_terms(e.term);
+            if (terms.empty())
+                throw std::runtime_error{"no words in phrase \"" + e.term + "\""};
+            if (terms.size() == 1)
+                return std::make_unique<TermIterator>(txn, dbis, terms[0]);
+
+            std::vector<std::unique_ptr<SpanIterator>> children;
+            for (auto& t : terms) children.push_back(std::make_unique<TermIterator>(txn, dbis, t));
+            return std::make_unique<PhraseIterator>(std::move(children));
+        }
+
+        case Expr::Near:
+            return std::make_unique<NearIterator>(compile_spans(e.children[0], txn, dbis),
+                                                  compile_spans(e.children[1], txn, dbis), e.slop);
+
+        default:
+            throw std::runtime_error{"NEAR only works on words and phrases"};
+    }
+}
+
+inline std::unique_ptr<DocIterator> compile(const Expr& e, lmdbpp::Txn& txn, const Dbis& dbis)
+{
+    std::vector<std::unique_ptr<DocIterator>> children;
+    switch (e.type)
+    {
+        case Expr::Term:
+        case Expr::Phrase:
+        case Expr::Near:
+            return compile_spans(e, txn, dbis);
+
+        case Expr::Or:
+            for (auto& c : e.children) children.push_back(compile(c, txn, dbis));
+            return std::make_unique<OrIterator>(std::move(children));
+
+        case Expr::Not:
+            return std::make_unique<AndNotIterator>(std::make_unique<AllDocsIterator>(txn, dbis),
+                                                    compile(e.children[0], txn, dbis));
+
+        case Expr::And:
+        {
+            // NOT children are subtracted from the intersection of the others instead of being iterated
+            std::vector<std::unique_ptr<DocIterator>> excluded;
+            for (auto& c : e.children)
+            {
+                if (c.type == Expr::Not)
+                    excluded.push_back(compile(c.children[0], txn, dbis));
+                else
+                    children.push_back(compile(c, txn, dbis));
+            }
+
+            std::unique_ptr<DocIterator> it;
+            if (children.empty())
+                it = std::make_unique<AllDocsIterator>(txn, dbis);
+            else if (children.size() == 1)
+                it = std::move(children[0]);
+            else
+                it = std::make_unique<AndIterator>(std::move(children));
+
+            if (excluded.size() == 1)
+                it = std::make_unique<AndNotIterator>(std::move(it), std::move(excluded[0]));
+            else if (!excluded.empty())
+                it = std::make_unique<AndNotIterator>(std::move(it), std::make_unique<OrIterator>(std::move(excluded)));
+            return it;
+        }
+    }
+    return nullptr;
+}
+
+// ids of all documents matching a boolean expression, evaluated lazily under a single read transaction
+class QueryIteratable : public lmdbpp::IteratableBase
+{
+public:
+    class Iterator : public lmdbpp::IteratorBase<Iterator, uint32_t>
+    {
+    protected:
+        friend lmdbpp::IteratorBase<Iterator, uint32_t>;
+        void next()
+        {
+            if (_started)
+                _root->next();
+            _started = true;
+
+            if (_root->valid())
+                this->_data = _root->doc();
+            else
+                this->_end = true;
+        }
+
+    private:
+        friend class QueryIteratable;
+        Iterator(DocIterator* root)
+            : _root(root)
+        {
+            next();
+        }
+
+        DocIterator* _root;
+        bool _started = false;
+    };
+
+    // the query reads through txn, which ends with the iteratable
+    QueryIteratable(lmdbpp::Txn&& txn, const Dbis& dbis, const std::string& expression)
+        : _txn{std::move(txn)}
+        , _dbis(dbis)
+        , _root{compile(Parser{expression}.parse(), _txn, _dbis)}
+    {
+    }
+
+    Iterator begin()
+    {
+        return Iterator{_root.get()};
+    }
+
+    // name of a matching document, read from the query's snapshot
+    std::string_view document_name(uint32_t doc)
+    {
+        lmdbpp::KeyVal<uint32_t, char> kv{{&doc}, {}};
+        _txn.get(_dbis.document_info, kv);
+        return lmdbpp::val_to_string_view(kv.val);
+    }
+
+protected:
+    lmdbpp::Txn _txn;
+    Dbis _dbis;
+    std::unique_ptr<DocIterator> _root;
+};
+
+}  // namespace query
+
+#endif
@@ -0,0 +1,405 @@
+#ifndef __query_server_h
+#define __query_server_h
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <poll.h>
+#include <sstream>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "lmdbfulltext.h"
+
+// answers queries on a unix socket, keeping the env open between them. one thread polls the connections and hands
+// each complete request to a pool of threads, so idle clients don't hold on to a thread. each query runs in its own
+// read transaction.
+//
+// line based protocol, one request per line:
+//
+//   docs <expression>                 -> "<doc id> <name>" per match
+//   count <expression>                -> "<n>"
+//   top <k> <expression>              -> "<score> <doc id> <name>" per result, best first
+//   examples <word> [width [limit]]   -> "<name>\t<left>\t<word>\t<right>" per occurrence
+//
+// each response ends with "ok <lines> <microseconds>" or "error <message>". requests on a connection are answered
+// one at a time, in order
+class QueryServer
+{
+public:
+    QueryServer(LmdbFullText& lft, const std::string& socket_path,
+                unsigned int threads = std::thread::hardware_concurrency())
+        : _lft(lft)
+        , _socket_path(socket_path)
+        , _threads(threads ? threads : 1)
+    {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(addr.sun_path))
+            throw std::runtime_error{"socket path too long: " + socket_path};
+        std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+        remove_stale_socket(addr);
+
+        // wakes the poll up when a worker is done with a connection or on stop()
+        if (pipe(_wake) < 0)
+            throw std::system_error{errno, std::generic_category(), "pipe"};
+        // neither end blocks: wake-ups are never lost waiting on a full pipe, and draining stops once it's empty
+        fcntl(_wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(_wake[1], F_SETFL, O_NONBLOCK);
+
+        _listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (_listen_fd < 0)
+        {
+            int error = errno;
+            close(_wake[0]);
+            close(_wake[1]);
+            throw std::system_error{error, std::generic_category(), "socket"};
+        }
+
+        if (bind(_listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(_listen_fd, 64) < 0)
+        {
+            int error = errno;
+            close(_listen_fd);
+            close(_wake[0]);
+            close(_wake[1]);
+            throw std::system_error{error, std::generic_category(), "couldn't listen on " + socket_path};
+        }
+    }
+
+    ~QueryServer()
+    {
+        close(_listen_fd);
+        close(_wake[0]);
+        close(_wake[1]);
+        unlink(_socket_path.c_str());
+    }
+
+    // accepts connections and serves their requests until stop() is called
+    void run()
+    {
+        std::vector<std::thread> workers;
+        for (unsigned int i = 0; i < _threads; ++i)
+        {
+            workers.emplace_back([this] { worker(); });
+        }
+
+        std::map<int, std::unique_ptr<Connection>> connections;
+        std::vector<pollfd> fds;
+        while (!_stopping)
+        {
+            // connections a worker has are left out until it hands them back
+            fds.assign({{_listen_fd, POLLIN, 0}, {_wake[0], POLLIN, 0}});
+            for (auto& [fd, c] : connections)
+            {
+                if (!c->busy)
+                    fds.push_back({fd, POLLIN, 0});
+            }
+
+            if (poll(fds.data(), fds.size(), -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                stop();
+                break;
+            }
+
+            if (fds[1].revents)
+            {
+                char drain[64];
+                while (read(_wake[0], drain, sizeof(drain)) > 0)
+                {
+                }
+
+                std::vector<Connection*> returned;
+                {
+                    std::lock_guard<std::mutex> lock{_mutex};
+                    returned.swap(_returned);
+                }
+                for (auto c : returned)
+                {
+                    c->busy = false;
+                    if (!c->open)
+                        connections.erase(c->fd);
+                    else if (c->has_request())
+                        dispatch(*c);
+                }
+            }
+
+            for (std::size_t i = 2; i < fds.size(); ++i)
+            {
+                if (!fds[i].revents)
+                    continue;
+                auto& c = *connections[fds[i].fd];
+                char chunk[4096];
+                auto n = recv(c.fd, chunk, sizeof(chunk), 0);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                {
+                    connections.erase(c.fd);
+                    continue;
+                }
+                c.buffer.append(chunk, n);
+                if (c.has_request())
+                    dispatch(c);
+            }
+
+            if (fds[0].revents && !_stopping)
+            {
+                int fd = accept(_listen_fd, nullptr, nullptr);
+                if (fd >= 0)
+                    connections.emplace(fd, std::make_unique<Connection>(fd));
+                else if (errno != EINTR && errno != ECONNABORTED)
+                    stop();
+            }
+        }
+
+        {
+            // workers may be sending to a client that doesn't read
+            std::lock_guard<std::mutex> lock{_mutex};
+            for (auto& [fd, c] : connections) shutdown(fd, SHUT_RDWR);
+            _not_empty.notify_all();
+        }
+        for (auto& w : workers) w.join();
+    }
+
+    // only async-signal-safe calls, so it can be called from a signal handler
+    void stop()
+    {
+        _stopping = true;
+        shutdown(_listen_fd, SHUT_RDWR);
+        char c = 0;
+        [[maybe_unused]] auto n = write(_wake[1], &c, 1);
+    }
+
+private:
+    // removes a socket left behind by a previous run. anything else at the path, or a socket a server still
+    // listens on, is an error rather than replaced
+    static void remove_stale_socket(const sockaddr_un& addr)
+    {
+        struct stat st;
+        if (lstat(addr.sun_path, &st) < 0)
+        {
+            if (errno == ENOENT)
+                return;
+            throw std::system_error{errno, std::generic_category(), std::string{"couldn't stat "} + addr.sun_path};
+        }
+        if (!S_ISSOCK(st.st_mode))
+            throw std::runtime_error{std::string{addr.sun_path} + " exists and isn't a socket"};
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            throw std::system_error{errno, std::generic_category(), "socket"};
+        int ret = connect(fd, (const sockaddr*)&addr, sizeof(addr));
+        int error = errno;
+        close(fd);
+        if (ret == 0)
+            throw std::runtime_error{std::string{"a server is already listening on "} + addr.sun_path};
+        if (error != ECONNREFUSED)
+            throw std::system_error{error, std::generic_category(), std::string{"couldn't check "} + addr.sun_path};
+        unlink(addr.sun_path);
+    }
+
+    struct Connection
+    {
+        explicit Connection(int fd)
+            : fd(fd)
+        {
+        }
+
+        ~Connection()
+        {
+            close(fd);
+        }
+
+        bool has_request() const
+        {
+            return buffer.find('\n') != std::string::npos;
+        }
+
+        const int fd;
+        std::string buffer;  // received, not yet answered
+        bool busy = false;   // queued for or being served by a worker, only the poll thread changes it
+        bool open = true;    // set by the worker
+    };
+
+    // hands a connection with a complete request to the workers
+    void dispatch(Connection& c)
+    {
+        c.busy = true;
+        std::lock_guard<std::mutex> lock{_mutex};
+        _pending.push_back(&c);
+        _not_empty.notify_one();
+    }
+
+    void worker()
+    {
+        while (true)
+        {
+            Connection* c;
+            {
+                std::unique_lock<std::mutex> lock{_mutex};
+                _not_empty.wait(lock, [this] { return !_pending.empty() || _stopping; });
+                if (_stopping)
+                    break;
+                c = _pending.front();
+                _pending.pop_front();
+            }
+
+            bool open = serve(*c);
+
+            {
+                std::lock_guard<std::mutex> lock{_mutex};
+                c->open = open;
+                _returned.push_back(c);
+            }
+            char wake = 0;
+            [[maybe_unused]] auto n = write(_wake[1], &wake, 1);
+        }
+    }
+
+    // answers the first request in the connection's buffer, false if the client is gone
+    bool serve(Connection& c)
+    {
+        auto newline = c.buffer.find('\n');
+        std::string request = c.buffer.substr(0, newline);
+        c.buffer.erase(0, newline + 1);
+        if (!request.empty() && request.back() == '\r')
+            request.pop_back();
+
+        auto begin = std::chrono::steady_clock::now();
+        std::ostringstream out;
+        std::size_t lines = 0;
+        std::string error;
+        try
+        {
+            lines = answer(request, out);
+        }
+        catch (std::exception& e)
+        {
+            error = e.what();
+        }
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin);
+
+        if (error.empty())
+            out << "ok " << lines << ' ' << us.count() << '\n';
+        else
+            out << "error " << error << '\n';
+        if (!send_all(c.fd, out.str()))
+            return false;
+
+        std::ostringstream log;
+        log << us.count() << "us " << (error.empty() ? "ok " : "error ") << request << '\n';
+        std::cerr << log.str();
+        return true;
+    }
+
+    // writes the response lines, returns how many
+    std::size_t answer(const std::string& request, std::ostream& out)
+    {
+        std::istringstream in{request};
+        std::string verb;
+        in >> verb;
+
+        std::size_t lines = 0;
+        if (verb == "docs" || verb == "count")
+        {
+            auto results = _lft.search(rest(in));
+            for (auto it = results.begin(); it != results.end(); ++it)
+            {
+                if (verb == "docs")
+                    out << *it << ' ' << results.document_name(*it) << '\n';
+                ++lines;
+            }
+            if (verb == "count")
+            {
+                out << lines << '\n';
+                lines = 1;
+            }
+        }
+        else if (verb == "top")
+        {
+            std::size_t k;
+            if (!(in >> k))
+                throw std::runtime_error{"usage: top <k> <expression>"};
+            auto top = _lft.search_top(rest(in), k);
+            for (auto& r : top.results())
+            {
+                out << r.score << ' ' << r.doc << ' ' << top.document_name(r.doc) << '\n';
+            }
+            lines = top.results().size();
+        }
+        else if (verb == "examples")
+        {
+            std::string word;
+            std::size_t width = 20;
+            std::size_t limit = 100;
+            std::size_t n;
+            in >> word;
+            if (in >> n)
+                width = n;
+            if (in >> n)
+                limit = n;
+            if (word.empty())
+                throw std::runtime_error{"usage: examples <word> [width [limit]]"};
+            lines = _lft.word_examples(word, width, limit, [&](const LmdbFullText::Example& e) {
+                out << e.document_name << '\t' << e.context.left << '\t' << e.context.word << '\t' << e.context.right
+                    << '\n';
+            });
+        }
+        else
+        {
+            throw std::runtime_error{"unknown request '" + verb + "'"};
+        }
+        return lines;
+    }
+
+    static std::string rest(std::istream& in)
+    {
+        std::string s;
+        std::getline(in >> std::ws, s);
+        return s;
+    }
+
+    static bool send_all(int fd, const std::string& data)
+    {
+        for (std::size_t sent = 0; sent < data.size();)
+        {
+            auto n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            sent += n;
+        }
+        return true;
+    }
+
+    LmdbFullText& _lft;
+    const std::string _socket_path;
+    const unsigned int _threads;
+    int _listen_fd = -1;
+
+    int _wake[2] = {-1, -1};
+
+    std::atomic<bool> _stopping{false};
+    std::mutex _mutex;
+    std::condition_variable _not_empty;
+    std::deque<Connection*> _pending;
+    std::vector<Connection*> _returned;  // by workers, for the poll thread
+};
+
+#endif
@@ -0,0 +1,276 @@
+#ifndef __ranking_h
+#define __ranking_h
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "lmdbpp.h"
+#include "query.h"
+
+namespace ranking
+{
+
+// meta key holding the total number of indexed words over all documents
+inline constexpr std::string_view total_length_key = "total_length";
+
+struct Bm25
+{
+    double k1 = 1.2;
+    double b = 0.75;
+};
+
+struct Result
+{
+    uint32_t doc;
+    double score;
+};
+
+// a word to score on, only its uses as pos if set
+using ScoredTerm = std::pair<std::string, std::optional<tagging::Pos>>;
+
+// words a query is scored on, everything that isn't under a NOT. phrase words count on their own
+inline void scored_terms(const query::Expr& e, std::set<ScoredTerm>& out)
+{
+    switch (e.type)
+    {
+        case query::Expr::Term:
+            out.emplace(e.term, e.pos);
+            break;
+        case query::Expr::Phrase:
+            for (auto& t : query::phrase_terms(e.term)) out.emplace(t, std::nullopt);
+            break;
+        case query::Expr::Not:
+            break;
+        default:
+            for (auto& c : e.children) scored_terms(c, out);
+    }
+}
+
+// true if every document containing one of the scored terms matches, so no filter is needed.
+// a word@pos term's scorer only sees the postings of that part of speech, so it still is one
+inline bool is_disjunction(const query::Expr& e)
+{
+    if (e.type == query::Expr::Term)
+        return true;
+    if (e.type != query::Expr::Or)
+        return false;
+    return std::all_of(e.children.begin(), e.children.end(), [](auto& c) { return is_disjunction(c); });
+}
+
+// top k documents by BM25, found with MaxScore: terms are ordered by their score upper bound, and once the k-th
+// best score exceeds the summed bounds of the weakest terms, those stop proposing candidates and are only
+// probed for documents the stronger terms found. so common words are mostly skipped over instead of scored.
+// documents also have to match the boolean expression, unless it's a plain OR of words
+class TopK
+{
+public:
+    TopK(lmdbpp::Txn&& txn, const query::Dbis& dbis, const std::string& expression, std::size_t k,
+         Bm25 params = {})
+        : _txn{std::move(txn)}
+        , _dbis(dbis)
+        , _params(params)
+    {
+        auto e = query::Parser{expression}.parse();
+        if (!is_disjunction(e))
+            _filter = query::compile(e, _txn, _dbis);
+
+        std::set<ScoredTerm> terms;
+        scored_terms(e, terms);
+        if (terms.empty())
+            throw std::runtime_error{"no words to rank by in query"};
+
+        // wildcards are scored as the terms they expand to
+        std::set<ScoredTerm> expanded;
+        for (auto& [t, pos] : terms)
+        {
+            if (query::is_pattern(t))
+                query::expand(_txn, _dbis.word_stats, t, [&](std::string_view term) { expanded.emplace(term, pos); });
+            else
+                expanded.emplace(t, pos);
+        }
+
+        read_collection_stats();
+        for (auto& [t, pos] : expanded)
+        {
+            // df, and so idf, counts documents using the word as any part of speech
+            auto it = std::make_unique<query::TermIterator>(_txn, _dbis, t, pos);
+            double df = it->cost();
+            double idf = std::log(1.0 + (_documents - df + 0.5) / (df + 0.5));
+            _scorers.push_back({std::move(it), idf, idf * (_params.k1 + 1.0)});
+        }
+
+        if (k)
+            run(k);
+    }
+
+    // best first, ties in document order
+    const std::vector<Result>& results() const
+    {
+        return _results;
+    }
+
+    // documents whose score was computed, at most every document containing one of the terms
+    std::size_t scored() const
+    {
+        return _scored;
+    }
+
+    // name of a ranked document, read from the query's snapshot
+    std::string_view document_name(uint32_t doc)
+    {
+        lmdbpp::KeyVal<uint32_t, char> kv{{&doc}, {}};
+        _txn.get(_dbis.document_info, kv);
+        return lmdbpp::val_to_string_view(kv.val);
+    }
+
+private:
+    struct Scorer
+    {
+        std::unique_ptr<query::TermIterator> it;
+        double idf;
+        double max_score;
+    };
+
+    static bool better(const Result& a, const Result& b)
+    {
+        return a.score > b.score || (a.score == b.score && a.doc < b.doc);
+    }
+
+    void read_collection_stats()
+    {
+        MDB_stat stat;
+        lmdbpp::check(mdb_stat(_txn, _dbis.document_info, &stat));
+        _documents = stat.ms_entries;
+
+        lmdbpp::KeyVal<char, uint64_t> kv{{total_length_key}, {}};
+        if (_txn.try_get(_dbis.meta, kv).found())
+        {
+            uint64_t total;
+            std::memcpy(&total, kv.val.data(), sizeof(total));
+            if (_documents && total)
+                _average_length = (double)total / _documents;
+        }
+    }
+
+    // 1 - b + b * length / average length, documents indexed without a length count as average
+    double length_norm(uint32_t doc)
+    {
+        lmdbpp::KeyVal<uint32_t, uint32_t> kv{{&doc}, {}};
+        if (!_txn.try_get(_dbis.document_length, kv).found())
+            return 1.0;
+        uint32_t length;
+        std::memcpy(&length, kv.val.data(), sizeof(length));
+        return 1.0 - _params.b + _params.b * length / _average_length;
+    }
+
+    // the scorer has to be on the document
+    double score(Scorer& s, double norm)
+    {
+        double tf = s.it->spans().size();
+        return s.idf * tf * (_params.k1 + 1.0) / (tf + _params.k1 * norm);
+    }
+
+    void run(std::size_t k)
+    {
+        std::sort(_scorers.begin(), _scorers.end(), [](auto& a, auto& b) { return a.max_score < b.max_score; });
+
+        // bound[i]: most a document can score from scorers 0..i
+        std::vector<double> bound(_scorers.size());
+        double sum = 0;
+        for (std::size_t i = 0; i < _scorers.size(); ++i) bound[i] = sum += _scorers[i].max_score;
+
+        // worst of the current top k on top
+        auto worse = [](const Result& a, const Result& b) { return better(a, b); };
+        std::priority_queue<Result, std::vector<Result>, decltype(worse)> heap{worse};
+        double threshold = 0;
+        std::size_t essential = 0;  // scorers before this one can't get a document into the top k on their own
+
+        while (essential < _scorers.size())
+        {
+            uint32_t doc = UINT32_MAX;
+            for (auto i = essential; i < _scorers.size(); ++i)
+            {
+                if (_scorers[i].it->valid())
+                    doc = std::min(doc, _scorers[i].it->doc());
+            }
+            if (doc == UINT32_MAX)
+                break;
+
+            if (_filter)
+            {
+                _filter->seek(doc);
+                if (!_filter->valid())
+                    break;
+                if (_filter->doc() != doc)
+                {
+                    for (auto i = essential; i < _scorers.size(); ++i) _scorers[i].it->seek(_filter->doc());
+                    continue;
+                }
+            }
+
+            ++_scored;
+            double norm = length_norm(doc);
+            double s = 0;
+            for (auto i = essential; i < _scorers.size(); ++i)
+            {
+                auto& scorer = _scorers[i];
+                if (scorer.it->valid() && scorer.it->doc() == doc)
+                {
+                    s += score(scorer, norm);
+                    scorer.it->next();
+                }
+            }
+            for (auto i = essential; i-- > 0;)
+            {
+                if (heap.size() == k && s + bound[i] <= threshold)
+                    break;
+                auto& scorer = _scorers[i];
+                scorer.it->seek(doc);
+                if (scorer.it->valid() && scorer.it->doc() == doc)
+                    s += score(scorer, norm);
+            }
+
+            Result r{doc, s};
+            if (heap.size() < k)
+            {
+                heap.push(r);
+            }
+            else if (better(r, heap.top()))
+            {
+                heap.pop();
+                heap.push(r);
+            }
+
+            if (heap.size() == k)
+            {
+                threshold = heap.top().score;
+                while (essential < _scorers.size() && bound[essential] <= threshold) ++essential;
+            }
+        }
+
+        for (; !heap.empty(); heap.pop()) _results.push_back(heap.top());
+        std::reverse(_results.begin(), _results.end());
+    }
+
+    lmdbpp::Txn _txn;
+    query::Dbis _dbis;
+    Bm25 _params;
+    std::unique_ptr<query::DocIterator> _filter;
+    std::vector<Scorer> _scorers;
+    uint64_t _documents = 0;
+    double _average_length = 1.0;
+    std::vector<Result> _results;
+    std::size_t _scored = 0;
+};
+
+}  // namespace ranking
+
+#endif
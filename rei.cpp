@@ -1,30 +1,126 @@
+#include <algorithm>
+#include <iomanip>
+#include <limits>
 #include <string>
 #include <string_view>
+#include <csignal>
+#include "batch_ingest.h"
 #include "lmdbfulltext.h"
+#include "query_server.h"
+
+static QueryServer* running_server = nullptr;
+
+static void stop_server(int)
+{
+    if (running_server)
+        running_server->stop();
+}
 
 int main(int argc, char** argv)
 {
     std::vector<std::string> args{argv, argv + argc};
-    if (args.size() < 4)
+
+    // ingest timings and counters, printed to stderr once done
+    auto stats_flag = std::find(args.begin(), args.end(), "--stats");
+    bool print_ingest_stats = stats_flag != args.end();
+    if (print_ingest_stats)
+        args.erase(stats_flag);
+
+    // memory budget in MiB for indexing one document, bigger ones spill postings to temporary files
+    std::size_t memory_budget = LmdbFullText::default_memory_budget;
+    auto memory_flag = std::find(args.begin(), args.end(), "--memory");
+    if (memory_flag != args.end() && memory_flag + 1 != args.end())
+    {
+        memory_budget = std::stoul(*(memory_flag + 1)) << 20;
+        args.erase(memory_flag, memory_flag + 2);
+    }
+
+    // relaxed durability for building an index, a crash means rebuilding it. see LmdbFullText's constructor
+    auto bulk_flag = std::find(args.begin(), args.end(), "--bulk");
+    bool bulk = bulk_flag != args.end();
+    if (bulk)
+        args.erase(bulk_flag);
+
+    if (args.size() < 4 && !(args.size() == 3 && args[2] == "stats"))
     {
-        std::cerr << "usage: " << args[0] << " <db> <noun> <verb> [options]" << std::endl;
+        std::cerr << "usage: " << args[0] << " <db> <noun> <verb> [options] [--stats] [--memory MiB] [--bulk]"
+                  << std::endl;
+        std::cerr << "       " << args[0] << " <db> stats" << std::endl;
         return 1;
     }
 
     auto arg = args.begin();
     std::string& db = *(++arg);
     std::string& noun = *(++arg);
-    std::string& verb = *(++arg);
+    std::string verb = args.size() > 3 ? *(++arg) : "";
 
-    LmdbFullText lft{db};
+    // everything but adding and removing documents only reads, so doesn't need to wait for a running ingest
+    bool writes = noun == "doc" && (verb == "add" || verb == "add-batch" || verb == "delete" || verb == "replace");
+    LmdbFullText lft{db, !writes, bulk};
+    lft.time_ingest_stages(print_ingest_stats);
+    lft.set_memory_budget(memory_budget);
 
     if (noun == "doc")
     {
         const std::string& name{*(++arg)};
         if (verb == "add")
         {
+            // "-" is stdin. pipes, fifos and the like are streamed in, regular files are mapped
             std::string& input_file{*(++arg)};
-            lft.add_document(name, input_file);
+            if (input_file == "-")
+            {
+                lft.add_document_stream(name, STDIN_FILENO);
+            }
+            else if (!std::filesystem::is_regular_file(input_file))
+            {
+                int fd = open(input_file.c_str(), O_RDONLY);
+                if (fd < 0)
+                {
+                    std::cerr << "couldn't open " << input_file << ": " << std::strerror(errno) << std::endl;
+                    return 1;
+                }
+                lft.add_document_stream(name, fd);
+                close(fd);
+            }
+            else
+            {
+                lft.add_document(name, input_file);
+            }
+        }
+        else if (verb == "delete")
+        {
+            if (!lft.delete_document(name))
+            {
+                std::cerr << "no document " << name << std::endl;
+                return 1;
+            }
+        }
+        else if (verb == "replace")
+        {
+            std::string& input_file{*(++arg)};
+            lft.replace_document(name, input_file);
+        }
+        else if (verb == "add-batch")
+        {
+            // name is either a directory or a file listing one path per line
+            // commits don't sync in a bulk load, bigger ones just save the per commit work
+            unsigned int threads = std::thread::hardware_concurrency();
+            std::size_t commit_docs = bulk ? 1024 : 64;
+            auto commit_time = std::chrono::milliseconds::max();
+            for (++arg; arg < args.end(); ++arg)
+            {
+                if (*arg == "--threads" && arg + 1 < args.end())
+                    threads = std::stoul(*(++arg));
+                else if (*arg == "--commit" && arg + 1 < args.end())
+                    commit_docs = std::stoul(*(++arg));
+                else if (*arg == "--commit-ms" && arg + 1 < args.end())
+                    commit_time = std::chrono::milliseconds{std::stoul(*(++arg))};
+            }
+
+            auto sources = std::filesystem::is_directory(name) ? BatchIngest::sources_from_directory(name)
+                                                               : BatchIngest::sources_from_list(name);
+            BatchIngest ingest{lft, threads, commit_docs, commit_time};
+            std::cout << ingest.run(sources) << " of " << sources.size() << " documents added" << std::endl;
         }
         else if (verb == "list")
         {
@@ -35,19 +131,49 @@ int main(int argc, char** argv)
         }
         else if (verb == "print")
         {
-            auto view = lft.view_document(name);
-            //std::cout << std::string_view{view.ptr(), view.size()} << std::endl;
-            std::cout<<lmdbpp::val_to_string_view(view)<<std::endl;
+            lft.document_text(name, [](std::string_view text) { std::cout << text; });
+            std::cout << std::endl;
         }
+
+        lft.finish_bulk_load();
+        if (print_ingest_stats)
+            lft.ingest_stats().print(std::cerr);
+    }
+    else if (noun == "stats")
+    {
+        auto info = lft.env_info();
+        std::cout << "map size " << info.me_mapsize << "\nlast page " << info.me_last_pgno << "\nlast txn "
+                  << info.me_last_txnid << "\nreaders " << info.me_numreaders << '/' << info.me_maxreaders
+                  << "\ntokens " << lft.token_count() << "\n\n";
+
+        std::cout << std::left << std::setw(18) << "table" << std::right << std::setw(12) << "entries"
+                  << std::setw(7) << "depth" << std::setw(10) << "branch" << std::setw(10) << "leaf"
+                  << std::setw(10) << "overflow" << std::setw(14) << "bytes" << '\n';
+        lft.table_stats([](const char* name, const MDB_stat& st) {
+            auto pages = st.ms_branch_pages + st.ms_leaf_pages + st.ms_overflow_pages;
+            std::cout << std::left << std::setw(18) << name << std::right << std::setw(12) << st.ms_entries
+                      << std::setw(7) << st.ms_depth << std::setw(10) << st.ms_branch_pages << std::setw(10)
+                      << st.ms_leaf_pages << std::setw(10) << st.ms_overflow_pages << std::setw(14)
+                      << pages * st.ms_psize << '\n';
+        });
+
+        IngestStats totals;
+        totals.add(lft.ingest_totals());
+        std::cout << "\ningest totals, stage times only of ingests run with --stats\n";
+        totals.print(std::cout);
     }
     else if (noun == "word")
     {
         if (verb == "indices")
         {
             std::string& word{*(++arg)};
-            for (auto& i : lft.word_indices(word))
+            bool reading = word == "--reading" && arg + 1 < args.end();
+            if (reading)
+                word = *(++arg);
+            auto indices = reading ? lft.reading_indices(word) : lft.word_indices(word);
+            for (auto block : indices.blocks())
             {
-                std::cout << std::hex << i.n << '\n';
+                for (auto& i : block) std::cout << i.doc() << ' ' << i.location() << ' ' << i.position << '\n';
             }
         }
         else if (verb == "count")
@@ -55,12 +181,113 @@ int main(int argc, char** argv)
             std::string& word{*(++arg)};
             std::cout << lft.word_occurrence_count(word) << std::endl;
         }
+        else if (verb == "stats")
+        {
+            std::string& word{*(++arg)};
+            auto stats = lft.word_stats(word);
+            std::cout << "occurrences " << stats.occurrences << "\ndocuments " << stats.documents << std::endl;
+        }
+        else if (verb == "examples")
+        {
+            std::string& word{*(++arg)};
+            std::size_t width = 20;
+            std::size_t limit = std::numeric_limits<std::size_t>::max();
+            for (++arg; arg < args.end(); ++arg)
+            {
+                if (*arg == "--width" && arg + 1 < args.end())
+                    width = std::stoul(*(++arg));
+                else if (*arg == "--limit" && arg + 1 < args.end())
+                    limit = std::stoul(*(++arg));
+            }
+
+            lft.word_examples(word, width, limit, [](const LmdbFullText::Example& e) {
+                std::cout << e.document_name << '\t' << e.context.left << '\t' << e.context.word << '\t'
+                          << e.context.right << '\n';
+            });
+        }
         else if (verb == "list")
         {
-            for (auto& w : lft.word_list())
+            if (arg + 2 < args.end() && *(arg + 1) == "--pos")
+            {
+                auto pos = tagging::pos_from_name(*(arg + 2));
+                if (!pos)
+                {
+                    std::cerr << "unknown part of speech " << *(arg + 2) << std::endl;
+                    return 1;
+                }
+                lft.word_list(*pos, [](std::string_view w) { std::cout << w << '\n'; });
+            }
+            else if (arg + 1 < args.end())
+            {
+                lft.word_list(*(arg + 1), [](std::string_view w) { std::cout << w << '\n'; });
+            }
+            else
+            {
+                for (auto& w : lft.word_list())
+                {
+                    std::cout << w.to_str() << '\n';
+                }
+            }
+        }
+    }
+    else if (noun == "serve")
+    {
+        std::string socket_path;
+        unsigned int threads = std::thread::hardware_concurrency();
+        for (arg = args.begin() + 3; arg < args.end(); ++arg)
+        {
+            if (*arg == "--socket" && arg + 1 < args.end())
+                socket_path = *(++arg);
+            else if (*arg == "--threads" && arg + 1 < args.end())
+                threads = std::stoul(*(++arg));
+        }
+        if (socket_path.empty())
+        {
+            std::cerr << "usage: " << args[0] << " <db> serve --socket <path> [--threads N]" << std::endl;
+            return 1;
+        }
+
+        QueryServer server{lft, socket_path, threads};
+        running_server = &server;
+        struct sigaction sa{};
+        sa.sa_handler = stop_server;
+        sigaction(SIGINT, &sa, nullptr);
+        sigaction(SIGTERM, &sa, nullptr);
+        server.run();
+        running_server = nullptr;
+    }
+    else if (noun == "query")
+    {
+        std::size_t k = 0;
+        if (verb == "top")
+            k = std::stoul(*(++arg));
+
+        std::string expression;
+        for (++arg; arg < args.end(); ++arg) expression += *arg + ' ';
+
+        if (verb == "top")
+        {
+            auto top = lft.search_top(expression, k);
+            for (auto& r : top.results())
             {
-                std::cout << w.to_str() << '\n';
+                std::cout << r.score << ' ' << r.doc << ' ' << top.document_name(r.doc) << '\n';
             }
+            return 0;
+        }
+
+        auto results = lft.search(expression);
+        if (verb == "docs")
+        {
+            for (auto doc : results)
+            {
+                std::cout << doc << ' ' << results.document_name(doc) << '\n';
+            }
+        }
+        else if (verb == "count")
+        {
+            std::size_t count = 0;
+            for (auto it = results.begin(); it != results.end(); ++it) ++count;
+            std::cout << count << std::endl;
         }
     }
     // lft.test();
@@ -68,8 +295,6 @@ int main(int argc, char** argv)
      * //TODO:
      * std::string_view wherever possible to reduce copies
      * tokenize: print whatever the tokeniser (mecab) makes of a string
-     * idx context: print text around a wordidx
-     * examples: iterate through all occurences of a word and print their surroundings
      */
 
     return 0;
@@ -1,20 +1,134 @@
 #ifndef __tokeniser_h
 #define __tokeniser_h
 
+#include <cstdint>
+#include <optional>
 #include <string>
+#include <string_view>
 
 namespace tagging
 {
 
+// coarse part of speech, the first feature column of IPADIC and UniDic
+enum class Pos : uint8_t
+{
+    Other,
+    Noun,
+    Pronoun,
+    Verb,
+    Adjective,
+    AdjectivalNoun,
+    Adverb,
+    Adnominal,
+    Conjunction,
+    Interjection,
+    Particle,
+    AuxiliaryVerb,
+    Prefix,
+    Suffix,
+    Symbol,
+    Filler,
+};
+
+struct PosName
+{
+    std::string_view name;
+    Pos pos;
+};
+
+// dictionary names first, then english ones for the command line
+constexpr PosName pos_names[] = {
+    {"名詞", Pos::Noun},           {"代名詞", Pos::Pronoun},       {"動詞", Pos::Verb},
+    {"形容詞", Pos::Adjective},    {"形状詞", Pos::AdjectivalNoun}, {"副詞", Pos::Adverb},
+    {"連体詞", Pos::Adnominal},    {"接続詞", Pos::Conjunction},   {"感動詞", Pos::Interjection},
+    {"助詞", Pos::Particle},       {"助動詞", Pos::AuxiliaryVerb}, {"接頭詞", Pos::Prefix},
+    {"接頭辞", Pos::Prefix},       {"接尾辞", Pos::Suffix},        {"記号", Pos::Symbol},
+    {"補助記号", Pos::Symbol},     {"フィラー", Pos::Filler},      {"その他", Pos::Other},
+    {"noun", Pos::Noun},           {"pronoun", Pos::Pronoun},      {"verb", Pos::Verb},
+    {"adjective", Pos::Adjective}, {"adjectival-noun", Pos::AdjectivalNoun},
+    {"adverb", Pos::Adverb},       {"adnominal", Pos::Adnominal},  {"conjunction", Pos::Conjunction},
+    {"interjection", Pos::Interjection},
+    {"particle", Pos::Particle},   {"auxiliary-verb", Pos::AuxiliaryVerb},
+    {"prefix", Pos::Prefix},       {"suffix", Pos::Suffix},        {"symbol", Pos::Symbol},
+    {"filler", Pos::Filler},       {"other", Pos::Other},
+};
+
+inline std::optional<Pos> pos_from_name(std::string_view name)
+{
+    for (auto& p : pos_names)
+    {
+        if (p.name == name)
+            return p.pos;
+    }
+    return {};
+}
+
+// views only, valid as long as the tagger's input and dictionary are.
+// feature columns are parsed on demand.
 struct Node
 {
-    uint32_t location;   // offset in bytes inside the document
-    std::string word;    // word as encountered in document
-    std::string feature; // original feature string
-    std::string base;    // base form of word
-    std::string reading; // reading in kana
+    uint32_t location;         // offset in bytes inside the document
+    std::string_view word;     // word as encountered in document
+    std::string_view feature;  // original feature string
+
+    // comma separated feature column, empty if there aren't that many columns
+    std::string_view feature_column(std::size_t n) const
+    {
+        std::size_t start = 0;
+        for (; n > 0; --n)
+        {
+            start = feature.find(',', start);
+            if (start == std::string_view::npos)
+                return {};
+            ++start;
+        }
+        auto end = feature.find(',', start);
+        return feature.substr(start, end == std::string_view::npos ? end : end - start);
+    }
+
+    // base form of word, falls back to the word itself for unknown words
+    std::string_view base() const
+    {
+        auto b = feature_column(6);
+        return b.empty() || b == "*" ? word : b;
+    }
+
+    // reading in kana
+    std::string_view reading() const
+    {
+        return feature_column(7);
+    }
+
+    Pos pos() const
+    {
+        return pos_from_name(feature_column(0)).value_or(Pos::Other);
+    }
 };
 
+// hiragana converted to katakana, which MeCab uses for readings. everything else is kept as is
+inline std::string to_katakana(std::string_view text)
+{
+    std::string out{text};
+    for (std::size_t i = 0; i + 2 < out.size(); ++i)
+    {
+        // U+3041..U+3096 are e3 81 81..e3 82 96, katakana are 0x60 code points further
+        auto b1 = (unsigned char)out[i + 1];
+        auto b2 = (unsigned char)out[i + 2];
+        if ((unsigned char)out[i] != 0xe3)
+            continue;
+
+        unsigned cp = 0x3000 | (b1 & 0x3f) << 6 | (b2 & 0x3f);
+        if (cp >= 0x3041 && cp <= 0x3096)
+        {
+            cp += 0x60;
+            out[i + 1] = (char)(0x80 | ((cp >> 6) & 0x3f));
+            out[i + 2] = (char)(0x80 | (cp & 0x3f));
+        }
+        i += 2;
+    }
+    return out;
+}
+
 class Tagger
 {
 public: